@@ -0,0 +1,342 @@
+// Offline benchmark of ANTN's streaming pipeline.
+//
+// Serves an mp3 file over HTTP on the loopback interface, with a
+// configurable bandwidth, jitter and periodic stalls, and plays it through
+// the same ANTNService, ANTNStream and ANTNReader the module uses, with a
+// thread standing in for the engine. It reports the time to first audio,
+// the decode CPU, the underruns and the decoded buffer depth over time.
+// With --resampler it measures the CPU cost of each resampler quality
+// offline instead.
+//
+//   make antn-bench
+//   build/antn-bench [options] file.mp3
+//   build/antn-bench --resampler [--rate HZ] file.mp3
+//
+// Linux and macOS only, the server uses POSIX sockets.
+
+#include "../src/ANTNService.hpp"
+#include <cstring>
+#include <cstdlib>
+#include <csignal>
+#include <random>
+#include <sys/socket.h>
+#include <sys/resource.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+#include <unistd.h>
+
+using namespace std;
+using namespace rack;
+using std::chrono::steady_clock;
+
+struct Options {
+  string file;
+  // delivery rate of the server, kbit/s
+  float bandwidth = 192.0f;
+  // each 10ms chunk is sent up to this late, ms
+  float jitter = 0.0f;
+  // the server goes silent for stall ms every stallEvery s
+  float stall = 0.0f;
+  float stallEvery = 10.0f;
+  float duration = 30.0f;
+  float prebuffer = 500.0f;
+  int quality = 10;
+  float sampleRate = 48000.0f;
+  // interval of the depth report, s
+  float interval = 1.0f;
+  string csv;
+  bool resampler = false;
+};
+
+void usage() {
+  fprintf(stderr,
+    "usage: antn-bench [options] file.mp3\n"
+    "  --bandwidth KBPS    server delivery rate (192)\n"
+    "  --jitter MS         random delay of each 10ms chunk, 0 to MS (0)\n"
+    "  --stall MS          outage length (0, none)\n"
+    "  --stall-every S     time between outages (10)\n"
+    "  --duration S        length of the run (30)\n"
+    "  --prebuffer MS      jitter buffer prebuffer (500)\n"
+    "  --quality Q         resampler quality, 0 to 10 or -1 for linear (10)\n"
+    "  --rate HZ           engine sample rate (48000)\n"
+    "  --interval S        buffer depth report interval (1)\n"
+    "  --csv FILE          buffer depth every 10ms as csv\n"
+    "  --resampler         only measure the resampler at each quality\n");
+  exit(1);
+}
+
+Options parseOptions(int argc, char **argv) {
+  Options o;
+  for (int i = 1; i < argc; i++) {
+    string a = argv[i];
+    bool value = i + 1 < argc;
+    if ((a == "--bandwidth") && value) o.bandwidth = atof(argv[++i]);
+    else if ((a == "--jitter") && value) o.jitter = atof(argv[++i]);
+    else if ((a == "--stall") && value) o.stall = atof(argv[++i]);
+    else if ((a == "--stall-every") && value) o.stallEvery = atof(argv[++i]);
+    else if ((a == "--duration") && value) o.duration = atof(argv[++i]);
+    else if ((a == "--prebuffer") && value) o.prebuffer = atof(argv[++i]);
+    else if ((a == "--quality") && value) o.quality = clamp(atoi(argv[++i]), ANTN_RESAMPLER_LINEAR, 10);
+    else if ((a == "--rate") && value) o.sampleRate = atof(argv[++i]);
+    else if ((a == "--interval") && value) o.interval = atof(argv[++i]);
+    else if ((a == "--csv") && value) o.csv = argv[++i];
+    else if (a == "--resampler") o.resampler = true;
+    else if ((a[0] != '-') && o.file.empty()) o.file = a;
+    else usage();
+  }
+  if (o.file.empty() || (o.bandwidth <= 0.0f) || (o.stallEvery <= 0.0f) || (o.interval <= 0.0f))
+    usage();
+  return o;
+}
+
+// Loopback stand-in for a radio server: answers any request with the file
+// looped forever, sent in 10ms chunks at the configured bandwidth. A late
+// chunk delays the following ones, a stall shifts the whole schedule.
+struct LoopbackServer {
+  const Options &options;
+  vector<char> data;
+  int listener = -1;
+  int port = 0;
+  std::atomic<bool> running;
+  std::atomic<size_t> sent;
+  thread worker;
+
+  LoopbackServer(const Options &o, const vector<char> &d) : options(o), data(d), running(true), sent(0) {
+    listener = socket(AF_INET, SOCK_STREAM, 0);
+    sockaddr_in addr = {};
+    addr.sin_family = AF_INET;
+    addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    addr.sin_port = 0;
+    socklen_t len = sizeof(addr);
+    if ((listener < 0) || (bind(listener, (sockaddr*)&addr, sizeof(addr)) != 0) || (listen(listener, 4) != 0) || (getsockname(listener, (sockaddr*)&addr, &len) != 0)) {
+      perror("antn-bench: server");
+      exit(1);
+    }
+    port = ntohs(addr.sin_port);
+    worker = thread(&LoopbackServer::serve, this);
+  }
+
+  ~LoopbackServer() {
+    running.store(false);
+    shutdown(listener, SHUT_RDWR);
+    close(listener);
+    worker.join();
+  }
+
+  void serve() {
+    while (running.load()) {
+      int client = accept(listener, NULL, NULL);
+      if (client < 0)
+        return;
+      // The request itself does not matter
+      char request[4096];
+      if (recv(client, request, sizeof(request), 0) > 0)
+        stream(client);
+      close(client);
+    }
+  }
+
+  void stream(int client) {
+    const char *header = "HTTP/1.0 200 OK\r\nContent-Type: audio/mpeg\r\n\r\n";
+    if (send(client, header, strlen(header), 0) < 0)
+      return;
+    std::mt19937 rng(1);
+    std::uniform_real_distribution<float> late(0.0f, options.jitter);
+    size_t chunk = max((size_t)(options.bandwidth * 1000.0f / 8.0f * 0.01f), (size_t)1);
+    size_t pos = 0;
+    auto start = steady_clock::now();
+    auto scheduled = start;
+    float nextStall = options.stallEvery;
+    while (running.load()) {
+      scheduled += std::chrono::milliseconds(10);
+      float elapsed = std::chrono::duration<float>(scheduled - start).count();
+      if ((options.stall > 0.0f) && (elapsed >= nextStall)) {
+        scheduled += std::chrono::microseconds((int64_t)(1000.0f * options.stall));
+        nextStall += options.stallEvery;
+      }
+      std::this_thread::sleep_until(scheduled + std::chrono::microseconds((int64_t)(1000.0f * late(rng))));
+      for (size_t n = 0; n < chunk; ) {
+        size_t part = min(chunk - n, data.size() - pos);
+        ssize_t written = send(client, data.data() + pos, part, 0);
+        if (written <= 0)
+          return;
+        n += written;
+        pos = (pos + written) % data.size();
+        sent += written;
+      }
+    }
+  }
+};
+
+// Decodes the whole file, then resamples it at every quality in the
+// decoder's block sizes while the drift correction sweeps over its range,
+// so the cost includes the ratio changes.
+void benchResampler(const Options &options, const vector<char> &data) {
+  static mp3dec_t mp3d;
+  mp3dec_init(&mp3d);
+  mp3dec_frame_info_t info;
+  vector<float> pcm;
+  float frame[MINIMP3_MAX_SAMPLES_PER_FRAME];
+  int channels = 0;
+  int hz = 0;
+  for (size_t pos = 0; pos < data.size(); ) {
+    int samples = mp3dec_decode_frame(&mp3d, (const uint8_t*)data.data() + pos, data.size() - pos, frame, &info);
+    if (info.frame_bytes == 0)
+      break;
+    pos += info.frame_bytes;
+    if ((samples == 0) || (channels && (info.channels != channels)))
+      continue;
+    channels = info.channels;
+    hz = info.hz;
+    pcm.insert(pcm.end(), frame, frame + samples * channels);
+  }
+  if (channels == 0) {
+    fprintf(stderr, "antn-bench: no mp3 frames in %s\n", options.file.c_str());
+    exit(1);
+  }
+  size_t frames = pcm.size() / channels;
+  float seconds = (float)frames / hz;
+  printf("%.1fs of %dHz %s audio to %.0fHz\n\n", seconds, hz, channels == 2 ? "stereo" : "mono", options.sampleRate);
+  printf("quality  CPU per second of audio  ratio changes\n");
+
+  vector<Frame<2>> out(ANTN_PCM_FRAMES * 8);
+  for (int quality = ANTN_RESAMPLER_LINEAR; quality <= 10; quality++) {
+    ANTNResampler conv;
+    conv.setQuality(quality);
+    int changes = 0;
+    auto start = steady_clock::now();
+    for (size_t pos = 0; pos < frames; ) {
+      // Two slow sweeps over the whole correction range
+      double correction = 1.0 + ANTN_MAX_CORRECTION * sin(4.0 * M_PI * pos / frames);
+      spx_uint32_t num = conv.ratioNum;
+      spx_uint32_t den = conv.ratioDen;
+      conv.setRates(channels, hz, (int)options.sampleRate, correction);
+      if ((conv.ratioNum != num) || (conv.ratioDen != den))
+        changes++;
+      int inSize = min(frames - pos, (size_t)1152);
+      int outSize = out.size();
+      conv.process(pcm.data() + pos * channels, &inSize, out.data(), &outSize);
+      pos += inSize;
+    }
+    float elapsed = std::chrono::duration<float>(steady_clock::now() - start).count();
+    // The first change is the initial setup
+    printf("%7s  %8.2fms (%5.2f%% core)  %13d\n", quality == ANTN_RESAMPLER_LINEAR ? "linear" : to_string(quality).c_str(),
+      1000.0f * elapsed / seconds, 100.0f * elapsed / seconds, changes - 1);
+  }
+}
+
+int main(int argc, char **argv) {
+  Options options = parseOptions(argc, argv);
+  signal(SIGPIPE, SIG_IGN);
+
+  vector<char> data;
+  FILE *f = fopen(options.file.c_str(), "rb");
+  if (!f) {
+    perror(options.file.c_str());
+    return 1;
+  }
+  char buf[65536];
+  size_t n;
+  while ((n = fread(buf, 1, sizeof(buf), f)) > 0)
+    data.insert(data.end(), buf, buf + n);
+  fclose(f);
+  if (data.empty()) {
+    fprintf(stderr, "antn-bench: %s is empty\n", options.file.c_str());
+    return 1;
+  }
+
+  if (options.resampler) {
+    benchResampler(options, data);
+    return 0;
+  }
+
+  curl_global_init(CURL_GLOBAL_ALL);
+  LoopbackServer server(options, data);
+  FILE *csv = NULL;
+  if (!options.csv.empty()) {
+    csv = fopen(options.csv.c_str(), "w");
+    if (csv)
+      fprintf(csv, "time_s,depth_ms,target_ms,correction,rebuffers\n");
+  }
+
+  std::shared_ptr<ANTNStream> stream = std::make_shared<ANTNStream>();
+  stream->sampleRate.store(options.sampleRate);
+  stream->resamplerQuality.store(options.quality);
+  stream->jitterBuffer.setPrebuffer(options.prebuffer / 1000.0f);
+  ANTNService::add(stream);
+
+  rusage usageStart;
+  getrusage(RUSAGE_SELF, &usageStart);
+  auto start = steady_clock::now();
+  stream->jitterBuffer.reset();
+  stream->request("http://127.0.0.1:" + to_string(server.port) + "/stream");
+
+  // Stands in for the engine, pulling frames in 1ms batches at the sample rate
+  ANTNReader reader;
+  uint64_t played = 0;
+  uint64_t silent = 0;
+  float loadSum = 0.0f;
+  int loadCount = 0;
+  float depthMin = INFINITY;
+  float depthMax = 0.0f;
+  double depthSum = 0.0;
+  int depthCount = 0;
+  float nextSample = 0.0f;
+  float nextReport = options.interval;
+  printf("   time   depth  target  correction  rebuffers  decode CPU\n");
+  while (true) {
+    std::this_thread::sleep_for(std::chrono::milliseconds(1));
+    float elapsed = std::chrono::duration<float>(steady_clock::now() - start).count();
+    if (elapsed >= options.duration)
+      break;
+    uint64_t due = (uint64_t)(elapsed * options.sampleRate);
+    for (; played < due; played++) {
+      Frame<2> frame;
+      if ((reader.read(stream.get(), options.sampleRate, frame) == 0.0f) && (stream->jitterBuffer.timeToFirstAudio.load() >= 0.0f))
+        silent++;
+    }
+    if (elapsed < nextSample)
+      continue;
+    nextSample += 0.01f;
+
+    float depth = stream->ready.load() ? 1000.0f * stream->dataAudioRingBuffer->size() / options.sampleRate : 0.0f;
+    float target = 1000.0f * stream->jitterBuffer.target.load();
+    int rebuffers = stream->jitterBuffer.rebuffers.load();
+    if (stream->jitterBuffer.timeToFirstAudio.load() >= 0.0f) {
+      depthMin = min(depthMin, depth);
+      depthMax = max(depthMax, depth);
+      depthSum += depth;
+      depthCount++;
+    }
+    if (csv)
+      fprintf(csv, "%.2f,%.1f,%.1f,%.6f,%d\n", elapsed, depth, target, stream->jitterBuffer.correction.load(), rebuffers);
+    if (elapsed >= nextReport) {
+      nextReport += options.interval;
+      float load = stream->decodeLoad.load();
+      loadSum += load;
+      loadCount++;
+      printf("%6.1fs %5.0fms %5.0fms  %+9.0fppm  %9d  %9.2f%%\n", elapsed, depth, target, 1e6f * (stream->jitterBuffer.correction.load() - 1.0f), rebuffers, 100.0f * load);
+    }
+  }
+
+  rusage usageEnd;
+  getrusage(RUSAGE_SELF, &usageEnd);
+  float wall = std::chrono::duration<float>(steady_clock::now() - start).count();
+  float cpu = (usageEnd.ru_utime.tv_sec - usageStart.ru_utime.tv_sec) + (usageEnd.ru_stime.tv_sec - usageStart.ru_stime.tv_sec)
+    + 1e-6f * ((usageEnd.ru_utime.tv_usec - usageStart.ru_utime.tv_usec) + (usageEnd.ru_stime.tv_usec - usageStart.ru_stime.tv_usec));
+
+  printf("\nbandwidth %.0fkbps, jitter %.0fms, stalls %.0fms every %.0fs, prebuffer %.0fms, quality %d, %.0fHz\n",
+    options.bandwidth, options.jitter, options.stall, options.stallEvery, options.prebuffer, options.quality, options.sampleRate);
+  printf("time to first audio   %.0fms\n", stream->jitterBuffer.timeToFirstAudio.load());
+  printf("underruns             %d (%.2fs silent)\n", stream->jitterBuffer.rebuffers.load(), silent / options.sampleRate);
+  if (depthCount > 0)
+    printf("buffer depth          %.0f / %.0f / %.0fms min / mean / max\n", depthMin, depthSum / depthCount, depthMax);
+  printf("decode CPU            %.2f%% of a core (service threads), %.2f%% whole process\n", loadCount ? 100.0f * loadSum / loadCount : 0.0f, 100.0f * cpu / wall);
+  printf("received              %.0fkB\n", server.sent.load() / 1000.0f);
+
+  ANTNService::remove(stream);
+  if (csv)
+    fclose(csv);
+  curl_global_cleanup();
+  return 0;
+}
@@ -0,0 +1,103 @@
+// Offline benchmark of LIMBO's ladder filter.
+//
+// Runs a stereo saw through StereoLadder, sample by sample as LIMBO::step
+// does, in the linear mode and in the saturating mode at each of the
+// oversampling factors of LIMBO's context menu, and reports the CPU per
+// second of audio of each. The cutoff follows a slow LFO as if it were
+// modulated, so the coefficients are recomputed every sample, unless
+// --fixed is given.
+//
+//   make ladder-bench
+//   build/ladder-bench [options]
+
+#include "ladder.hpp"
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <string>
+#include <vector>
+#include <chrono>
+
+using namespace std;
+using std::chrono::steady_clock;
+
+struct Options {
+	float duration = 10.0f;
+	float sampleRate = 44100.0f;
+	float q = 0.5f;
+	float drive = 0.5f;
+	bool fixed = false;
+};
+
+void usage() {
+	fprintf(stderr,
+		"usage: ladder-bench [options]\n"
+		"  --duration S        length of the test signal (10)\n"
+		"  --rate HZ           sample rate (44100)\n"
+		"  --q X               resonance knob, 0 to 1 (0.5)\n"
+		"  --drive X           gain knob, 0 to 1 (0.5)\n"
+		"  --fixed             hold the cutoff instead of sweeping it\n");
+	exit(1);
+}
+
+Options parseOptions(int argc, char **argv) {
+	Options o;
+	for (int i = 1; i < argc; i++) {
+		string a = argv[i];
+		bool value = i + 1 < argc;
+		if ((a == "--duration") && value) o.duration = atof(argv[++i]);
+		else if ((a == "--rate") && value) o.sampleRate = atof(argv[++i]);
+		else if ((a == "--q") && value) o.q = atof(argv[++i]);
+		else if ((a == "--drive") && value) o.drive = atof(argv[++i]);
+		else if (a == "--fixed") o.fixed = true;
+		else usage();
+	}
+	if ((o.duration <= 0.0f) || (o.sampleRate <= 0.0f) || (o.q < 0.0f) || (o.q > 1.0f) || (o.drive < 0.0f) || (o.drive > 1.0f))
+		usage();
+	return o;
+}
+
+int main(int argc, char **argv) {
+	Options options = parseOptions(argc, argv);
+
+	size_t frames = (size_t)(options.duration * options.sampleRate);
+	vector<float> inL(frames), inR(frames), cutoff(frames);
+	for (size_t i = 0; i < frames; i++) {
+		float t = i / options.sampleRate;
+		inL[i] = 2.0f * fmodf(110.0f * t, 1.0f) - 1.0f;
+		inR[i] = 2.0f * fmodf(110.5f * t, 1.0f) - 1.0f;
+		// LIMBO's cutoff knob mapping, 2^4.5 to 2^13 Hz
+		float knob = options.fixed ? 0.5f : 0.5f + 0.5f * sinf(2.0f * M_PI * 0.5f * t);
+		cutoff[i] = powf(2.0f, 4.5f + 8.5f * knob);
+	}
+	float q = 3.5f * options.q;
+	float g = powf(2.0f, 3.0f * options.drive);
+	float seconds = frames / options.sampleRate;
+	printf("%.1fs at %.0fHz, %s cutoff\n\n", seconds, options.sampleRate, options.fixed ? "fixed" : "swept");
+
+	struct Run {
+		int mode;
+		const char *name;
+		int oversampling;
+	};
+	const Run runs[] = {{0, "Off", 1}, {1, "Off", 1}, {1, "2x", 2}, {1, "4x", 4}, {1, "8x", 8}};
+
+	printf("mode        oversampling  CPU per second of audio\n");
+	float sink = 0.0f;
+	for (const Run &run : runs) {
+		StereoLadder *ladder = new StereoLadder();
+		auto start = steady_clock::now();
+		for (size_t i = 0; i < frames; i++) {
+			float l = inL[i], r = inR[i];
+			ladder->process(cutoff[i], q, g, run.mode, run.oversampling, options.sampleRate, l, r);
+			sink += l + r;
+		}
+		float time = std::chrono::duration<float>(steady_clock::now() - start).count();
+		delete ladder;
+		printf("%-10s  %12s  %8.2fms (%5.2f%% core)\n", run.mode ? "saturating" : "linear", run.name, 1000.0f * time / seconds, 100.0f * time / seconds);
+	}
+	// keeps the outputs alive
+	if (sink == 12345.0f)
+		printf("\n");
+	return 0;
+}
@@ -0,0 +1,121 @@
+// Offline benchmark of DFUZE's shimmer pitch shifter.
+//
+// Shifts the same test signal with fftPitchShifter and with the
+// smbPitchShifter it replaced (kept in bench/smbPitchShift.cpp), in the
+// 32-frame blocks DFUZE runs, and reports the CPU per second of audio of
+// each and how far the new output is from the old one. smbPitchShifter
+// has one voice, so each extra voice is one more instance summed in.
+//
+//   make pitchshift-bench
+//   build/pitchshift-bench [options]
+
+#include "fftPitchShift.hpp"
+#include "smbPitchShift.hpp"
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <string>
+#include <vector>
+#include <chrono>
+#include <random>
+
+using namespace std;
+using std::chrono::steady_clock;
+
+struct Options {
+	float duration = 10.0f;
+	float sampleRate = 44100.0f;
+	long frameSize = 2048;
+	long osamp = 4;
+	int voices = 1;
+};
+
+void usage() {
+	fprintf(stderr,
+		"usage: pitchshift-bench [options]\n"
+		"  --duration S        length of the test signal (10)\n"
+		"  --rate HZ           sample rate (44100)\n"
+		"  --frame N           FFT frame size, a power of 2 (2048)\n"
+		"  --osamp N           STFT oversampling (4)\n"
+		"  --voices N          shimmer voices, 1 to %d (1)\n", FFT_PITCH_SHIFT_MAX_VOICES);
+	exit(1);
+}
+
+Options parseOptions(int argc, char **argv) {
+	Options o;
+	for (int i = 1; i < argc; i++) {
+		string a = argv[i];
+		bool value = i + 1 < argc;
+		if ((a == "--duration") && value) o.duration = atof(argv[++i]);
+		else if ((a == "--rate") && value) o.sampleRate = atof(argv[++i]);
+		else if ((a == "--frame") && value) o.frameSize = atol(argv[++i]);
+		else if ((a == "--osamp") && value) o.osamp = atol(argv[++i]);
+		else if ((a == "--voices") && value) o.voices = atoi(argv[++i]);
+		else usage();
+	}
+	if ((o.duration <= 0.0f) || (o.frameSize < 8) || (o.frameSize > MAX_FRAME_LENGTH) || (o.frameSize & (o.frameSize - 1))
+		|| (o.osamp < 1) || (o.voices < 1) || (o.voices > FFT_PITCH_SHIFT_MAX_VOICES))
+		usage();
+	return o;
+}
+
+int main(int argc, char **argv) {
+	Options options = parseOptions(argc, argv);
+	const int block = 32;
+	const float ratios[FFT_PITCH_SHIFT_MAX_VOICES] = {2.0f, powf(2.0f, 7.0f / 12.0f), 0.5f};
+	const float gains[FFT_PITCH_SHIFT_MAX_VOICES] = {1.0f, 0.7f, 0.5f};
+
+	// A reverb tail stand-in: a few partials over noise
+	size_t frames = (size_t)(options.duration * options.sampleRate) / block * block;
+	vector<float> in(frames);
+	std::mt19937 rng(1);
+	std::uniform_real_distribution<float> noise(-0.05f, 0.05f);
+	for (size_t i = 0; i < frames; i++) {
+		float t = i / options.sampleRate;
+		in[i] = 0.3f * sinf(2.0f * M_PI * 220.0f * t) + 0.2f * sinf(2.0f * M_PI * 1234.5f * t) + noise(rng);
+	}
+	float seconds = frames / options.sampleRate;
+	printf("%.1fs at %.0fHz, frame %ld, osamp %ld, %d voice%s\n\n", seconds, options.sampleRate, options.frameSize, options.osamp,
+		options.voices, options.voices > 1 ? "s" : "");
+
+	vector<float> ref(frames, 0.0f);
+	vector<float> tmp(block);
+	auto start = steady_clock::now();
+	{
+		vector<smbPitchShifter*> shifters;
+		for (int v = 0; v < options.voices; v++)
+			shifters.push_back(new smbPitchShifter(options.frameSize, options.osamp));
+		for (size_t pos = 0; pos < frames; pos += block) {
+			for (int v = 0; v < options.voices; v++) {
+				shifters[v]->process(ratios[v], block, options.sampleRate, &in[pos], tmp.data());
+				for (int i = 0; i < block; i++)
+					ref[pos + i] += gains[v] * tmp[i];
+			}
+		}
+		for (smbPitchShifter *s : shifters)
+			delete s;
+	}
+	float smbTime = std::chrono::duration<float>(steady_clock::now() - start).count();
+
+	vector<float> out(frames);
+	start = steady_clock::now();
+	{
+		fftPitchShifter shifter(options.frameSize, options.osamp);
+		for (size_t pos = 0; pos < frames; pos += block)
+			shifter.process(ratios, gains, options.voices, block, &in[pos], &out[pos]);
+	}
+	float fftTime = std::chrono::duration<float>(steady_clock::now() - start).count();
+
+	double refEnergy = 0.0, diffEnergy = 0.0;
+	for (size_t i = 0; i < frames; i++) {
+		refEnergy += (double)ref[i] * ref[i];
+		diffEnergy += (double)(out[i] - ref[i]) * (out[i] - ref[i]);
+	}
+
+	printf("shifter          CPU per second of audio\n");
+	printf("smbPitchShifter  %8.2fms (%5.2f%% core)\n", 1000.0f * smbTime / seconds, 100.0f * smbTime / seconds);
+	printf("fftPitchShifter  %8.2fms (%5.2f%% core)\n", 1000.0f * fftTime / seconds, 100.0f * fftTime / seconds);
+	printf("\nspeedup               %.2fx\n", smbTime / fftTime);
+	printf("difference            %.1fdB below the smbPitchShifter output\n", -10.0 * log10(diffEnergy / refEnergy));
+	return 0;
+}
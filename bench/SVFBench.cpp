@@ -0,0 +1,152 @@
+// Offline benchmark of PERCO's state variable filter.
+//
+// Runs a stereo saw through the per-sample SVF PERCO had before, which
+// recomputes its coefficients with tan() every sample, one instance per
+// channel, and through the current path: SVFCoefficients read every
+// SVF_CONTROL_RATE samples and ramped, with both channels on the lanes of
+// one MultiFilter. The cutoff follows a slow LFO as if it were modulated.
+// Reports the CPU per second of audio of each, the speedup and how far
+// the new lowpass output is from the old one.
+//
+//   make svf-bench
+//   build/svf-bench [options]
+
+#include "svf.hpp"
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <string>
+#include <vector>
+#include <chrono>
+
+using namespace std;
+using std::chrono::steady_clock;
+
+// PERCO's MultiFilter before the control-rate coefficients, one channel
+struct perSampleSVF
+{
+	float q;
+	float freq;
+	float smpRate;
+	float hp = 0.0f,bp = 0.0f,lp = 0.0f,mem1 = 0.0f,mem2 = 0.0f;
+
+	void setParams(float freq, float q, float smpRate) {
+		this->freq = freq;
+		this->q=q;
+		this->smpRate=smpRate;
+	}
+
+	void calcOutput(float sample)
+	{
+		float g = tan(SVF_PI*freq/smpRate);
+		float R = 1.0f/(2.0f*q);
+		hp = (sample - (2.0f*R + g)*mem1 - mem2)/(1.0f + 2.0f*R*g + g*g);
+		bp = g*hp + mem1;
+		lp = g*bp +  mem2;
+		mem1 = g*hp + bp;
+		mem2 = g*bp + lp;
+	}
+};
+
+struct Options {
+	float duration = 10.0f;
+	float sampleRate = 44100.0f;
+	float q = 0.5f;
+	float rate = 0.5f;
+};
+
+void usage() {
+	fprintf(stderr,
+		"usage: svf-bench [options]\n"
+		"  --duration S        length of the test signal (10)\n"
+		"  --rate HZ           sample rate (44100)\n"
+		"  --q X               resonance knob, 0.1 to 1 (0.5)\n"
+		"  --lfo HZ            cutoff sweep rate, 0 holds it (0.5)\n");
+	exit(1);
+}
+
+Options parseOptions(int argc, char **argv) {
+	Options o;
+	for (int i = 1; i < argc; i++) {
+		string a = argv[i];
+		bool value = i + 1 < argc;
+		if ((a == "--duration") && value) o.duration = atof(argv[++i]);
+		else if ((a == "--rate") && value) o.sampleRate = atof(argv[++i]);
+		else if ((a == "--q") && value) o.q = atof(argv[++i]);
+		else if ((a == "--lfo") && value) o.rate = atof(argv[++i]);
+		else usage();
+	}
+	if ((o.duration <= 0.0f) || (o.sampleRate <= 0.0f) || (o.q < 0.1f) || (o.q > 1.0f) || (o.rate < 0.0f))
+		usage();
+	return o;
+}
+
+int main(int argc, char **argv) {
+	Options options = parseOptions(argc, argv);
+
+	size_t frames = (size_t)(options.duration * options.sampleRate);
+	vector<float> inL(frames), inR(frames), cutoff(frames);
+	for (size_t i = 0; i < frames; i++) {
+		float t = i / options.sampleRate;
+		inL[i] = 2.0f * fmodf(110.0f * t, 1.0f) - 1.0f;
+		inR[i] = 2.0f * fmodf(110.5f * t, 1.0f) - 1.0f;
+		// PERCO's cutoff knob mapping, 2^4.5 to 2^13 Hz
+		float knob = 0.5f + 0.4f * sinf(2.0f * M_PI * options.rate * t);
+		cutoff[i] = powf(2.0f, 4.5f + 8.5f * knob);
+	}
+	float q = 10.0f * options.q;
+	float seconds = frames / options.sampleRate;
+	printf("%.1fs at %.0fHz, cutoff swept at %.2fHz\n\n", seconds, options.sampleRate, options.rate);
+
+	vector<float> refL(frames), refR(frames);
+	auto start = steady_clock::now();
+	{
+		perSampleSVF left, right;
+		for (size_t i = 0; i < frames; i++) {
+			left.setParams(cutoff[i], q, options.sampleRate);
+			right.setParams(cutoff[i], q, options.sampleRate);
+			left.calcOutput(inL[i]);
+			right.calcOutput(inR[i]);
+			refL[i] = left.lp;
+			refR[i] = right.lp;
+		}
+	}
+	float perSampleTime = std::chrono::duration<float>(steady_clock::now() - start).count();
+
+	vector<float> outL(frames), outR(frames);
+	start = steady_clock::now();
+	{
+		SVFCoefficients coefs;
+		MultiFilter filter;
+		int controlCounter = 0;
+		for (size_t i = 0; i < frames; i++) {
+			if (controlCounter-- <= 0) {
+				controlCounter = SVF_CONTROL_RATE - 1;
+				coefs.setParams(cutoff[i], q, options.sampleRate);
+			}
+			coefs.tick();
+			filter.calcOutput(_mm_setr_ps(inL[i], inR[i], 0.0f, 0.0f), coefs);
+			float lp[4];
+			_mm_storeu_ps(lp, filter.lp);
+			outL[i] = lp[0];
+			outR[i] = lp[1];
+		}
+	}
+	float simdTime = std::chrono::duration<float>(steady_clock::now() - start).count();
+
+	double refEnergy = 0.0, diffEnergy = 0.0;
+	for (size_t i = 0; i < frames; i++) {
+		refEnergy += (double)refL[i] * refL[i] + (double)refR[i] * refR[i];
+		diffEnergy += (double)(outL[i] - refL[i]) * (outL[i] - refL[i]) + (double)(outR[i] - refR[i]) * (outR[i] - refR[i]);
+	}
+
+	printf("path                     CPU per second of audio\n");
+	printf("per-sample coefficients  %8.2fms (%5.2f%% core)\n", 1000.0f * perSampleTime / seconds, 100.0f * perSampleTime / seconds);
+	printf("control-rate SIMD        %8.2fms (%5.2f%% core)\n", 1000.0f * simdTime / seconds, 100.0f * simdTime / seconds);
+	printf("\nspeedup                 %.2fx\n", perSampleTime / simdTime);
+	if (diffEnergy == 0.0)
+		printf("difference              none, the outputs are identical\n");
+	else
+		printf("difference              %.1fdB below the per-sample lowpass\n", -10.0 * log10(diffEnergy / refEnergy));
+	return 0;
+}
@@ -27,14 +27,6 @@ void comb::setbuffer(float *buf, int size)
 	bufsize = size;
 }
 
-void comb::changebuffer(float *buf, int size)
-	{
-		if (buffer) {delete buffer;}
-		buffer = new float[size];
-		bufsize = size;
-		bufidx = 0;
-}
-
 void comb::mute()
 {
 	for (int i=0; i<bufsize; i++)
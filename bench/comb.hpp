@@ -3,6 +3,9 @@
 // Written by Jezar at Dreampoint, June 2000
 // http://www.dreampoint.co.uk
 // This code is public domain
+//
+// No longer used by revmodel, which runs its combs as SSE lanes. Kept as
+// the per-sample reference for bench/ReverbBench.cpp.
 
 #ifndef _comb_
 #define _comb_
@@ -12,7 +15,6 @@ struct comb
 	comb();
 	~comb();
 	void	setbuffer(float *buf, int size);
-	void	changebuffer(float *buf, int size);
 	inline float	process(float inp);
 	void	mute();
 	void	setdamp(float val);
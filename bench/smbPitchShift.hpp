@@ -0,0 +1,39 @@
+#ifndef smbPitchShift_h
+#define smbPitchShift_h
+
+#ifndef M_PI
+#define M_PI 3.14159265358979323846
+#endif
+#define MAX_FRAME_LENGTH 8192
+
+void smbFft(float *fftBuffer, long fftFrameSize, long sign);
+double smbAtan2(double x, double y);
+
+// DFUZE's shimmer shifter before fftPitchShifter, kept as the reference
+// for bench/PitchShiftBench.cpp. Phase vocoder state of one channel,
+// allocated once for its frame size.
+class smbPitchShifter {
+public:
+	smbPitchShifter(long fftFrameSize, long osamp);
+	~smbPitchShifter();
+	smbPitchShifter(const smbPitchShifter&) = delete;
+	smbPitchShifter& operator=(const smbPitchShifter&) = delete;
+	void reset();
+	void process(float pitchShift, long numSampsToProcess, float sampleRate, const float *indata, float *outdata);
+
+protected:
+	long fftFrameSize, osamp;
+	long gRover;
+	float *gInFIFO;
+	float *gOutFIFO;
+	float *gFFTworksp;
+	float *gLastPhase;
+	float *gSumPhase;
+	float *gOutputAccum;
+	float *gAnaFreq;
+	float *gAnaMagn;
+	float *gSynFreq;
+	float *gSynMagn;
+};
+
+#endif // smbPitchShift_h
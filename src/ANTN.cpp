@@ -1,175 +1,13 @@
 #include "Bidoo.hpp"
 #include "dsp/digital.hpp"
-#include "dsp/samplerate.hpp"
 #include "BidooComponents.hpp"
-#include "curl/curl.h"
-#include "dsp/ringbuffer.hpp"
-#include "dsp/frame.hpp"
+#include "ANTNService.hpp"
+#include "osdialog.h"
 #include <algorithm>
 #include <cctype>
-#include <atomic>
-#include <sstream>
-#include <thread>
-#define MINIMP3_IMPLEMENTATION
-#include "dep/minimp3/minimp3.h"
 
 using namespace std;
-
-struct threadReadData {
-  DoubleRingBuffer<char,262144> *dataToDecodeRingBuffer;
-  string url;
-  string secUrl;
-  std::atomic<bool> *dl;
-  std::atomic<bool> *free;
-};
-
-struct threadDecodeData {
-  DoubleRingBuffer<char,262144> *dataToDecodeRingBuffer;
-  DoubleRingBuffer<Frame<2>,262144> *dataAudioRingBuffer;
-  mp3dec_t mp3d;
-  std::atomic<bool> *dc;
-  std::atomic<bool> *free;
-};
-
-size_t WriteMemoryCallback(void *contents, size_t size, size_t nmemb, void *userp)
-{
-  struct threadReadData *pData = (struct threadReadData *) userp;
-  size_t realsize = size * nmemb;
-  if ((pData->dl->load()) && (realsize < pData->dataToDecodeRingBuffer->capacity()))   //
-  {
-    memcpy(pData->dataToDecodeRingBuffer->endData(), contents, realsize);
-    pData->dataToDecodeRingBuffer->endIncr(realsize);
-    return realsize;
-  }
-  return 0;
-}
-
-size_t WriteUrlCallback(void *contents, size_t size, size_t nmemb, void *userp)
-{
-  struct threadReadData *pData = (struct threadReadData *) userp;
-  size_t realsize = size * nmemb;
-  pData->secUrl += (const char*) contents;
-  return realsize;
-}
-
-void * threadDecodeTask(threadDecodeData data)
-{
-  data.free->store(false);
-
-  mp3dec_frame_info_t info;
-  DoubleRingBuffer<Frame<2>,4096> *tmpBuffer = new DoubleRingBuffer<Frame<2>,4096>();
-  SampleRateConverter<2> conv;
-  int inSize;
-  int outSize;
-
-  while (data.dc->load()) {
-
-    short pcm[MINIMP3_MAX_SAMPLES_PER_FRAME];
-
-    if (data.dataToDecodeRingBuffer->size() > 64000) {
-
-      int samples = mp3dec_decode_frame(&data.mp3d, (const uint8_t*)data.dataToDecodeRingBuffer->startData(), data.dataToDecodeRingBuffer->size(), pcm, &info);
-
-      if (info.frame_bytes > 0) {
-        if (samples > 0) {
-          if (info.channels == 1) {
-            for(int i = 0; i < samples; i++) {
-              if (!data.dc->load()) break;
-              Frame<2> newFrame;
-              newFrame.samples[0]=(float)pcm[i]/32768;
-              newFrame.samples[1]=(float)pcm[i]/32768;
-              tmpBuffer->push(newFrame);
-            }
-          }
-          else {
-            for(int i = 0; i < 2 * samples; i=i+2) {
-              if (!data.dc->load()) break;
-              Frame<2> newFrame;
-              newFrame.samples[0]=(float)pcm[i]/32768;
-              newFrame.samples[1]=(float)pcm[i+1]/32768;
-              tmpBuffer->push(newFrame);
-            }
-          }
-        }
-        if (samples == 0) {
-          //printf("invalid data \n");
-        }
-        data.dataToDecodeRingBuffer->startIncr(info.frame_bytes);
-        conv.setRates(info.hz, engineGetSampleRate());
-        conv.setQuality(10);
-        inSize = tmpBuffer->size();
-        outSize = data.dataAudioRingBuffer->capacity();
-        conv.process(tmpBuffer->startData(), &inSize,data.dataAudioRingBuffer->endData(), &outSize);
-        tmpBuffer->startIncr(inSize);
-        data.dataAudioRingBuffer->endIncr((size_t)outSize);
-      }
-    }
-  }
-
-  data.free->store(true);
-  return 0;
-}
-
-void * threadReadTask(threadReadData data)
-{
-  data.free->store(false);
-
-  CURL *curl;
-  curl = curl_easy_init();
-  curl_easy_setopt(curl, CURLOPT_SSL_VERIFYPEER, 0L);
-  curl_easy_setopt(curl, CURLOPT_SSL_VERIFYHOST, 0L);
-  curl_easy_setopt(curl, CURLOPT_FOLLOWLOCATION, 1L);
-
-  string zeUrl;
-  data.secUrl == "" ? zeUrl = data.url : zeUrl = data.secUrl;
-  zeUrl.erase(std::remove_if(zeUrl.begin(), zeUrl.end(), [](unsigned char x){return std::isspace(x);}), zeUrl.end());
-  if (stringExtension(data.url) == "pls") {
-    istringstream iss(zeUrl);
-    for (std::string line; std::getline(iss, line); )
-    {
-      std::size_t found=line.find("http");
-      if (found!=std::string::npos) {
-        zeUrl = line.substr(found);
-        break;
-      }
-    }
-  }
-
-  curl_easy_setopt(curl, CURLOPT_URL, zeUrl.c_str());
-  curl_easy_setopt(curl, CURLOPT_WRITEFUNCTION, WriteMemoryCallback);
-  curl_easy_setopt(curl, CURLOPT_WRITEDATA, &data);
-  curl_easy_perform(curl);
-  curl_easy_cleanup(curl);
-
-  data.free->store(true);
-
-  return 0;
-}
-
-
-void * urlTask(threadReadData data)
-{
-  data.free->store(false);
-
-  CURL *curl;
-  curl = curl_easy_init();
-  curl_easy_setopt(curl, CURLOPT_SSL_VERIFYPEER, 0L);
-  curl_easy_setopt(curl, CURLOPT_SSL_VERIFYHOST, 0L);
-  curl_easy_setopt(curl, CURLOPT_FOLLOWLOCATION, 1L);
-  curl_easy_setopt(curl, CURLOPT_URL, data.url.c_str());
-  curl_easy_setopt(curl, CURLOPT_WRITEFUNCTION, WriteUrlCallback);
-  curl_easy_setopt(curl, CURLOPT_WRITEDATA, &data);
-  data.secUrl = "";
-  curl_easy_perform(curl);
-  curl_easy_cleanup(curl);
-
-  data.free->store(true);
-
-  thread iThread = thread(threadReadTask, data);
-  iThread.detach();
-
-  return 0;
-}
+using namespace rack;
 
 struct ANTN : Module {
 	enum ParamIds {
@@ -191,47 +29,32 @@ struct ANTN : Module {
 	};
   string url;
 	SchmittTrigger trigTrigger;
-  bool read = false;
-  DoubleRingBuffer<Frame<2>,262144> dataAudioRingBuffer;
-  DoubleRingBuffer<char,262144> dataToDecodeRingBuffer;
-  thread rThread, dThread;
-  threadReadData rData;
-  threadDecodeData dData;
-  std::atomic<bool> tDl;
-  std::atomic<bool> tDc;
-  std::atomic<bool> trFree;
-  std::atomic<bool> tdFree;
+  int prebufferPolicy = PREBUFFER_BALANCED;
+  float customPrebuffer = 500.0f;
+  int recordMode = RECORD_OFF;
+  string recordDir;
+  int resamplerQuality = 10;
+  std::shared_ptr<ANTNStream> stream;
+  ANTNReader reader;
 
 	ANTN() : Module(NUM_PARAMS, NUM_INPUTS, NUM_OUTPUTS, NUM_LIGHTS) {
-    tDl.store(true);
-    tDc.store(true);
-    trFree.store(true);
-    tdFree.store(true);
-
-    rData.dataToDecodeRingBuffer = &dataToDecodeRingBuffer;
-    rData.dl = &tDl;
-    rData.free = &trFree;
-
-    dData.dataToDecodeRingBuffer = &dataToDecodeRingBuffer;
-    dData.dataAudioRingBuffer = &dataAudioRingBuffer;
-    dData.dc = &tDc;
-    dData.free = &tdFree;
-    mp3dec_init(&dData.mp3d);
+    stream = std::make_shared<ANTNStream>();
+    stream->sampleRate.store(engineGetSampleRate());
+    ANTNService::add(stream);
 	}
 
   ~ANTN() {
-    tDc.store(false);
-    while(!tdFree) {
-    }
-
-    tDl.store(false);
-    while(!trFree) {
-    }
+    ANTNService::remove(stream);
   }
 
   json_t *toJson() override {
     json_t *rootJ = json_object();
     json_object_set_new(rootJ, "url", json_string(url.c_str()));
+    json_object_set_new(rootJ, "prebufferPolicy", json_integer(prebufferPolicy));
+    json_object_set_new(rootJ, "customPrebuffer", json_real(customPrebuffer));
+    json_object_set_new(rootJ, "recordMode", json_integer(recordMode));
+    json_object_set_new(rootJ, "recordDir", json_string(recordDir.c_str()));
+    json_object_set_new(rootJ, "resamplerQuality", json_integer(resamplerQuality));
     return rootJ;
   }
 
@@ -239,6 +62,40 @@ struct ANTN : Module {
     json_t *urlJ = json_object_get(rootJ, "url");
   	if (urlJ)
   		url = json_string_value(urlJ);
+    json_t *prebufferPolicyJ = json_object_get(rootJ, "prebufferPolicy");
+    if (prebufferPolicyJ)
+      prebufferPolicy = clamp((int)json_integer_value(prebufferPolicyJ), (int)PREBUFFER_MINIMAL, (int)PREBUFFER_CUSTOM);
+    json_t *customPrebufferJ = json_object_get(rootJ, "customPrebuffer");
+    if (customPrebufferJ)
+      customPrebuffer = json_number_value(customPrebufferJ);
+    updatePrebuffer();
+    json_t *recordDirJ = json_object_get(rootJ, "recordDir");
+    if (recordDirJ)
+      recordDir = json_string_value(recordDirJ);
+    json_t *recordModeJ = json_object_get(rootJ, "recordMode");
+    if (recordModeJ)
+      recordMode = clamp((int)json_integer_value(recordModeJ), (int)RECORD_OFF, (int)RECORD_DECODED);
+    updateRecord();
+    json_t *resamplerQualityJ = json_object_get(rootJ, "resamplerQuality");
+    if (resamplerQualityJ)
+      resamplerQuality = clamp((int)json_integer_value(resamplerQualityJ), ANTN_RESAMPLER_LINEAR, 10);
+    stream->resamplerQuality.store(resamplerQuality);
+  }
+
+  void updateRecord() {
+    stream->record(recordMode, recordDir.empty() ? assetLocal("") : recordDir);
+  }
+
+  void updatePrebuffer() {
+    if (prebufferPolicy == PREBUFFER_CUSTOM)
+      stream->jitterBuffer.setPrebuffer(clamp(customPrebuffer, 20.0f, 5000.0f) / 1000.0f);
+    else
+      stream->jitterBuffer.setPrebuffer(ANTN_PREBUFFER_PRESETS[prebufferPolicy]);
+  }
+
+  // Decoded frames waiting to be played, 0 before the first trigger
+  size_t bufferedFrames() {
+    return stream->ready.load() ? stream->dataAudioRingBuffer->size() : 0;
   }
 
 	void step() override;
@@ -247,54 +104,24 @@ struct ANTN : Module {
 };
 
 void ANTN::onSampleRateChange() {
-  read = false;
-  dataAudioRingBuffer.clear();
+  stream->sampleRate.store(engineGetSampleRate());
+  stream->jitterBuffer.read = false;
+  stream->jitterBuffer.fade = 0.0f;
+  if (stream->ready.load())
+    stream->dataAudioRingBuffer->flush();
 }
 
 void ANTN::step() {
 
 	if (trigTrigger.process(params[TRIG_PARAM].value)) {
-
-    tDc.store(false);
-    while(!tdFree) {
-    }
-
-    tDl.store(false);
-    while(!trFree) {
-    }
-    read = false;
-    dataToDecodeRingBuffer.clear();
-    dataAudioRingBuffer.clear();
-
-    tDl.store(true);
-    rData.url = url;
-    if ((stringExtension(rData.url) == "m3u") || (stringExtension(rData.url) == "pls")) {
-      rThread = thread(urlTask, std::ref(rData));
-    }
-    else {
-      rThread = thread(threadReadTask, std::ref(rData));
-    }
-    rThread.detach();
-
-    tDc.store(true);
-    mp3dec_init(&dData.mp3d);
-    dThread = thread(threadDecodeTask, std::ref(dData));
-    dThread.detach();
+    stream->jitterBuffer.reset();
+    stream->request(url);
 	}
 
-  if ((dataAudioRingBuffer.size()>64000) && (engineGetSampleRate()<96000)) {
-    read = true;
-  }
-  if ((dataAudioRingBuffer.size()>128000) && (engineGetSampleRate()>=96000)) {
-    read = true;
-  }
-
-  if (read) {
-    Frame<2> currentFrame = *dataAudioRingBuffer.startData();
-    outputs[OUTL_OUTPUT].value = 10*currentFrame.samples[0]*params[GAIN_PARAM].value;
-    outputs[OUTR_OUTPUT].value = 10*currentFrame.samples[1]*params[GAIN_PARAM].value;
-    dataAudioRingBuffer.startIncr(1);
-  }
+  Frame<2> currentFrame;
+  float fade = reader.read(stream.get(), engineGetSampleRate(), currentFrame);
+  outputs[OUTL_OUTPUT].value = 10*currentFrame.samples[0]*params[GAIN_PARAM].value*fade;
+  outputs[OUTR_OUTPUT].value = 10*currentFrame.samples[1]*params[GAIN_PARAM].value*fade;
 }
 
 struct ANTNTextField : LedDisplayTextField {
@@ -310,7 +137,10 @@ struct ANTNTextField : LedDisplayTextField {
 void ANTNTextField::onTextChange() {
 	if (text.size() > 0) {
       string tText = text;
-      tText.erase(std::remove_if(tText.begin(), tText.end(), [](unsigned char x){return std::isspace(x);}), tText.end());
+      // Paths may contain spaces, only trim them
+      trim(tText);
+      if (!isLocal(tText))
+        tText.erase(std::remove_if(tText.begin(), tText.end(), [](unsigned char x){return std::isspace(x);}), tText.end());
       module->url = tText;
 	}
 }
@@ -319,6 +149,7 @@ struct ANTNWidget : ModuleWidget {
   TextField *textField;
 	json_t *toJson() override;
 	void fromJson(json_t *rootJ) override;
+	Menu *createContextMenu() override;
 
 	ANTNWidget(ANTN *module) : ModuleWidget(module) {
 		setPanel(SVG::load(assetPlugin(plugin, "res/ANTN.svg")));
@@ -363,4 +194,183 @@ void ANTNWidget::fromJson(json_t *rootJ) {
 		textField->text = json_string_value(textJ);
 }
 
+struct ANTNPrebufferItem : MenuItem {
+	ANTN *antnModule;
+	int policy;
+	void onAction(EventAction &e) override {
+		antnModule->prebufferPolicy = policy;
+		antnModule->updatePrebuffer();
+	}
+	void step() override {
+		rightText = (antnModule->prebufferPolicy == policy) ? "✔" : "";
+		MenuItem::step();
+	}
+};
+
+struct ANTNCustomPrebufferField : TextField {
+	ANTN *antnModule;
+	void onTextChange() override {
+		float ms = atof(text.c_str());
+		if (ms > 0.0f) {
+			antnModule->customPrebuffer = ms;
+			antnModule->prebufferPolicy = PREBUFFER_CUSTOM;
+			antnModule->updatePrebuffer();
+		}
+	}
+};
+
+struct ANTNInfoLabel : MenuLabel {
+	ANTN *antnModule;
+	void step() override {
+		float sr = engineGetSampleRate();
+		ANTNJitterBuffer &jitterBuffer = antnModule->stream->jitterBuffer;
+		float timeToFirstAudio = jitterBuffer.timeToFirstAudio.load();
+		if (timeToFirstAudio >= 0.0f)
+			text = stringf("First audio %.0fms, buffer %.0f/%.0fms", timeToFirstAudio,
+				1000.0f * antnModule->bufferedFrames() / sr, 1000.0f * jitterBuffer.target.load());
+		else
+			text = stringf("Buffering %.0f/%.0fms", 1000.0f * antnModule->bufferedFrames() / sr, 1000.0f * jitterBuffer.target.load());
+		MenuLabel::step();
+	}
+};
+
+struct ANTNRecordItem : MenuItem {
+	ANTN *antnModule;
+	int mode;
+	void onAction(EventAction &e) override {
+		antnModule->recordMode = mode;
+		antnModule->updateRecord();
+	}
+	void step() override {
+		rightText = (antnModule->recordMode == mode) ? "✔" : "";
+		MenuItem::step();
+	}
+};
+
+struct ANTNRecordDirItem : MenuItem {
+	ANTN *antnModule;
+	void onAction(EventAction &e) override {
+		std::string dir = antnModule->recordDir.empty() ? assetLocal("") : antnModule->recordDir;
+		char *path = osdialog_file(OSDIALOG_OPEN_DIR, dir.c_str(), NULL, NULL);
+		if (path) {
+			antnModule->recordDir = path;
+			antnModule->updateRecord();
+			free(path);
+		}
+	}
+};
+
+struct ANTNResamplerItem : MenuItem {
+	ANTN *antnModule;
+	int quality;
+	void onAction(EventAction &e) override {
+		antnModule->resamplerQuality = quality;
+		antnModule->stream->resamplerQuality.store(quality);
+	}
+	void step() override {
+		rightText = (antnModule->resamplerQuality == quality) ? "✔" : "";
+		MenuItem::step();
+	}
+};
+
+struct ANTNStatsLabel : MenuLabel {
+	ANTN *antnModule;
+	void step() override {
+		text = stringf("Decode CPU %.1f%%, rebuffers %d", 100.0f * antnModule->stream->decodeLoad.load(),
+			antnModule->stream->jitterBuffer.rebuffers.load());
+		MenuLabel::step();
+	}
+};
+
+Menu *ANTNWidget::createContextMenu() {
+	Menu *menu = ModuleWidget::createContextMenu();
+
+	ANTN *antnModule = dynamic_cast<ANTN*>(module);
+	assert(antnModule);
+
+	MenuLabel *spacerLabel = new MenuLabel();
+	menu->addChild(spacerLabel);
+
+	MenuLabel *prebufferLabel = new MenuLabel();
+	prebufferLabel->text = "Prebuffer";
+	menu->addChild(prebufferLabel);
+
+	static const char *policyNames[3] = {"Minimal (150ms)", "Balanced (500ms)", "Safe (1500ms)"};
+	for (int i = PREBUFFER_MINIMAL; i < PREBUFFER_CUSTOM; i++) {
+		ANTNPrebufferItem *policyItem = new ANTNPrebufferItem();
+		policyItem->text = policyNames[i];
+		policyItem->antnModule = antnModule;
+		policyItem->policy = i;
+		menu->addChild(policyItem);
+	}
+
+	ANTNPrebufferItem *customItem = new ANTNPrebufferItem();
+	customItem->text = "Custom (ms)";
+	customItem->antnModule = antnModule;
+	customItem->policy = PREBUFFER_CUSTOM;
+	menu->addChild(customItem);
+
+	ANTNCustomPrebufferField *customField = new ANTNCustomPrebufferField();
+	customField->antnModule = antnModule;
+	customField->box.size = Vec(120.0f, 20.0f);
+	customField->text = stringf("%.0f", antnModule->customPrebuffer);
+	menu->addChild(customField);
+
+	spacerLabel = new MenuLabel();
+	menu->addChild(spacerLabel);
+
+	MenuLabel *recordLabel = new MenuLabel();
+	recordLabel->text = "Record";
+	menu->addChild(recordLabel);
+
+	static const char *recordNames[3] = {"Off", "Stream (mp3)", "Decoded audio (wav)"};
+	for (int i = RECORD_OFF; i <= RECORD_DECODED; i++) {
+		ANTNRecordItem *recordItem = new ANTNRecordItem();
+		recordItem->text = recordNames[i];
+		recordItem->antnModule = antnModule;
+		recordItem->mode = i;
+		menu->addChild(recordItem);
+	}
+
+	ANTNRecordDirItem *recordDirItem = new ANTNRecordDirItem();
+	recordDirItem->text = "Record folder...";
+	recordDirItem->antnModule = antnModule;
+	menu->addChild(recordDirItem);
+
+	spacerLabel = new MenuLabel();
+	menu->addChild(spacerLabel);
+
+	MenuLabel *resamplerLabel = new MenuLabel();
+	resamplerLabel->text = "Resampler quality";
+	menu->addChild(resamplerLabel);
+
+	for (int i = ANTN_RESAMPLER_LINEAR; i <= 10; i++) {
+		ANTNResamplerItem *resamplerItem = new ANTNResamplerItem();
+		if (i == ANTN_RESAMPLER_LINEAR)
+			resamplerItem->text = "Linear (fastest)";
+		else if (i == 0)
+			resamplerItem->text = "0 (fast)";
+		else if (i == 10)
+			resamplerItem->text = "10 (best)";
+		else
+			resamplerItem->text = stringf("%d", i);
+		resamplerItem->antnModule = antnModule;
+		resamplerItem->quality = i;
+		menu->addChild(resamplerItem);
+	}
+
+	spacerLabel = new MenuLabel();
+	menu->addChild(spacerLabel);
+
+	ANTNInfoLabel *infoLabel = new ANTNInfoLabel();
+	infoLabel->antnModule = antnModule;
+	menu->addChild(infoLabel);
+
+	ANTNStatsLabel *statsLabel = new ANTNStatsLabel();
+	statsLabel->antnModule = antnModule;
+	menu->addChild(statsLabel);
+
+	return menu;
+}
+
 Model *modelANTN = Model::create<ANTN, ANTNWidget>("Bidoo", "antN", "antN oscillator", OSCILLATOR_TAG);
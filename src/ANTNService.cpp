@@ -0,0 +1,792 @@
+#include "ANTNService.hpp"
+#include <algorithm>
+#include <cctype>
+#include <sstream>
+#include <ctime>
+#include <cstdint>
+#include <sys/stat.h>
+#define MINIMP3_IMPLEMENTATION
+#include "dep/minimp3/minimp3.h"
+
+using namespace std;
+using namespace rack;
+
+// Compressed bytes needed at the read position before calling minimp3.
+// Once synced it decodes the frame there as soon as the frame and the next
+// header are in. Before that it scans for a run of matching frames and
+// drops everything it scanned when the run is cut by the end of the data,
+// so the first plausible header must be followed by a few frames. Headers
+// whose next frame does not match are skipped.
+static size_t mp3BytesNeeded(const mp3dec_t *dec, const uint8_t *mp3, size_t available) {
+  if ((available > HDR_SIZE) && (dec->header[0] == 0xff) && hdr_compare(dec->header, mp3))
+    return hdr_frame_bytes(mp3, dec->free_format_bytes) + hdr_padding(mp3) + HDR_SIZE;
+  for (size_t i = 0; i + HDR_SIZE < available; i++) {
+    const uint8_t *h = mp3 + i;
+    if (!hdr_valid(h))
+      continue;
+    size_t frameBytes = hdr_frame_bytes(h, 0) + hdr_padding(h);
+    // Free format, its size is only known from the next header
+    if (frameBytes <= HDR_SIZE)
+      break;
+    if ((i + frameBytes + HDR_SIZE <= available) && !hdr_compare(h, h + frameBytes))
+      continue;
+    return min(i + ANTN_SYNC_FRAMES * frameBytes + HDR_SIZE, ANTN_DECODE_LOOKAHEAD);
+  }
+  return ANTN_DECODE_LOOKAHEAD;
+}
+
+static size_t WriteMemoryCallback(void *contents, size_t size, size_t nmemb, void *userp)
+{
+  ANTNStream *stream = (ANTNStream *) userp;
+  size_t realsize = size * nmemb;
+  // No room yet: libcurl keeps the data and the I/O thread resumes the transfer later
+  if (stream->dataToDecodeRingBuffer->capacity() < realsize) {
+    stream->paused = true;
+    return CURL_WRITEFUNC_PAUSE;
+  }
+  stream->dataToDecodeRingBuffer->write((const char*)contents, realsize);
+  return realsize;
+}
+
+static size_t WriteUrlCallback(void *contents, size_t size, size_t nmemb, void *userp)
+{
+  ANTNStream *stream = (ANTNStream *) userp;
+  size_t realsize = size * nmemb;
+  stream->secUrl.append((const char*) contents, realsize);
+  return realsize;
+}
+
+static string extension(const string &path) {
+  size_t dot = path.find_last_of("./\\");
+  return ((dot == string::npos) || (path[dot] != '.')) ? "" : path.substr(dot + 1);
+}
+
+static string directory(const string &path) {
+  size_t slash = path.find_last_of("/\\");
+  return (slash == string::npos) ? "." : path.substr(0, slash);
+}
+
+static bool isPlaylist(const string &url) {
+  return (extension(url) == "m3u") || (extension(url) == "pls");
+}
+
+bool isLocal(const string &url) {
+  struct stat st;
+  return (url.compare(0, 7, "file://") == 0) || ((stat(url.c_str(), &st) == 0) && S_ISREG(st.st_mode));
+}
+
+static string localPath(const string &url) {
+  if (url.compare(0, 16, "file://localhost") == 0)
+    return url.substr(16);
+  if (url.compare(0, 7, "file://") == 0)
+    return url.substr(7);
+  return url;
+}
+
+void trim(string &s) {
+  s.erase(0, s.find_first_not_of(" \t\r\n"));
+  s.erase(s.find_last_not_of(" \t\r\n") + 1);
+}
+
+// First entry of an m3u or pls playlist. Entries of a local playlist
+// without a scheme are paths, relative ones are taken from dir, the
+// playlist's directory (empty for a remote playlist).
+static string parsePlaylist(const string &playlist, bool pls, const string &dir) {
+  // Skips the UTF-8 byte order mark some editors write
+  istringstream iss(playlist.compare(0, 3, "\xEF\xBB\xBF") == 0 ? playlist.substr(3) : playlist);
+  for (std::string line; std::getline(iss, line); )
+  {
+    trim(line);
+    if (line.empty() || (line[0] == '#'))
+      continue;
+    if (pls) {
+      // Only the FileN=location keys hold entries
+      size_t equal = line.find('=');
+      if ((line.compare(0, 4, "File") != 0) || (equal == std::string::npos))
+        continue;
+      line = line.substr(equal + 1);
+      trim(line);
+      if (line.empty())
+        continue;
+    }
+    bool absolute = (line[0] == '/') || (line[0] == '\\') || ((line.size() > 1) && (line[1] == ':'));
+    if (!dir.empty() && (line.find("://") == std::string::npos) && !absolute)
+      return dir + "/" + line;
+    return line;
+  }
+  return "";
+}
+
+// Decodes at most ANTN_DECODE_QUOTA mp3 frames of one stream, returns true if it did any work.
+// Must be called with the stream's decodeMutex held.
+static bool decodeStream(ANTNStream *stream) {
+  if (!stream->ready.load())
+    return false;
+
+  auto begin = std::chrono::steady_clock::now();
+  SPSCRingBuffer<char,262144> *bytes = stream->dataToDecodeRingBuffer;
+  SPSCRingBuffer<Frame<2>,262144> *frames = stream->dataAudioRingBuffer;
+  int gen = stream->generation.load();
+
+  if (stream->decoderGen != gen) {
+    // As for the recorder taps, the end is read before the generation so
+    // the bytes below it are known to be older than what that says
+    size_t end = bytes->end.load(std::memory_order_acquire);
+    if (stream->ioGeneration.load(std::memory_order_acquire) != gen) {
+      // The I/O thread may still be writing the previous station
+      bytes->flushTo(end);
+      return false;
+    }
+    // Bytes of the new station may already follow ioGenerationAt
+    bytes->flushTo(stream->ioGenerationAt.load());
+    mp3dec_init(&stream->mp3d);
+    stream->conv.reset();
+    if (!stream->pcm)
+      stream->pcm = new float[ANTN_PCM_FRAMES * 2];
+    stream->pcmFrames = 0;
+    stream->pcmChannels = 2;
+    stream->hz = 0;
+    stream->decoderSplice = stream->splice.load(std::memory_order_acquire);
+    stream->jitterBuffer.smoothedFill = 0.0f;
+    stream->lastUpdate = begin;
+    stream->loadStart = begin;
+    stream->decodeTime = 0.0f;
+    stream->decoderGen = gen;
+    stream->decodedGenerationAt.store(frames->end.load(std::memory_order_relaxed));
+    stream->decodedGeneration.store(gen, std::memory_order_release);
+  }
+
+  mp3dec_frame_info_t info;
+  int inSize;
+  int outSize;
+  bool worked = false;
+
+  for (int n = 0; n < ANTN_DECODE_QUOTA; n++) {
+
+    bool idle = true;
+
+    // The size is read before the splice so bytes of a new connection are never
+    // seen without their splice.
+    size_t available = bytes->size();
+    int splice = stream->splice.load(std::memory_order_acquire);
+    bool splicing = splice != stream->decoderSplice;
+    if (splicing)
+      available = stream->spliceAt.load() - bytes->start.load(std::memory_order_relaxed);
+    // Past the end of a connection the lookahead cannot fill up anymore
+    bool ending = splicing || stream->eof.load(std::memory_order_acquire);
+    size_t lookahead = 1;
+    if (!ending && (available > 0))
+      lookahead = mp3BytesNeeded(&stream->mp3d, (const uint8_t*)bytes->startData(), available);
+
+    // The compressed data is contiguous from startData() so minimp3 decodes in place,
+    // and nothing is decoded while the previous frames are still waiting for room.
+    if ((available >= lookahead) && (ANTN_PCM_FRAMES - stream->pcmFrames >= MINIMP3_MAX_SAMPLES_PER_FRAME/2)) {
+
+      float *pcm = stream->pcm + stream->pcmFrames * stream->pcmChannels;
+      int samples = mp3dec_decode_frame(&stream->mp3d, (const uint8_t*)bytes->startData(), available, pcm, &info);
+
+      if ((info.frame_bytes == 0) && ending) {
+        // Truncated last frame of the connection
+        bytes->startIncr(available);
+        available = 0;
+        idle = false;
+      }
+      else if (info.frame_bytes > 0) {
+        idle = false;
+        if (samples > 0) {
+          if (info.channels != stream->pcmChannels) {
+            // Channel layout changed, drop the few pending frames of the old one
+            memmove(stream->pcm, pcm, sizeof(float) * samples * info.channels);
+            stream->pcmFrames = 0;
+            stream->pcmChannels = info.channels;
+          }
+          stream->pcmFrames += samples;
+        }
+        bytes->startIncr(info.frame_bytes);
+        available -= info.frame_bytes;
+        if (info.hz > 0) stream->hz = info.hz;
+      }
+    }
+
+    // Everything of the old connection is resampled, start over on the new one
+    if (splicing && (available == 0) && (stream->pcmFrames == 0)) {
+      mp3dec_init(&stream->mp3d);
+      stream->conv.reset();
+      stream->decoderSplice = splice;
+      stream->frameSpliceAt.store(frames->end.load(std::memory_order_relaxed));
+      stream->frameSplice.fetch_add(1, std::memory_order_release);
+      idle = false;
+    }
+
+    float sampleRate = stream->sampleRate.load();
+    size_t fill = frames->size();
+    auto now = std::chrono::steady_clock::now();
+    float dt = std::chrono::duration<float>(now - stream->lastUpdate).count();
+    stream->lastUpdate = now;
+    size_t ringSize = frames->maxSize();
+    float correction = stream->jitterBuffer.updateCorrection(fill, ringSize, sampleRate, dt);
+
+    // Keep at most 1.5 times the target decoded, the rest waits compressed
+    bool room = fill < 1.5f * stream->jitterBuffer.targetFrames(ringSize, sampleRate);
+
+    // Resample only into the free contiguous space, leftovers move to the front of pcm
+    if ((stream->hz > 0) && room && (stream->pcmFrames > 0) && !frames->full()) {
+      stream->conv.setQuality(stream->resamplerQuality.load());
+      stream->conv.setRates(stream->pcmChannels, stream->hz, sampleRate, correction);
+      inSize = stream->pcmFrames;
+      outSize = frames->capacity();
+      stream->conv.process(stream->pcm, &inSize, frames->endData(), &outSize);
+      frames->endIncr((size_t)outSize);
+      stream->pcmFrames -= inSize;
+      if (stream->pcmFrames > 0)
+        memmove(stream->pcm, stream->pcm + inSize * stream->pcmChannels, sizeof(float) * stream->pcmFrames * stream->pcmChannels);
+      if (outSize > 0) idle = false;
+    }
+
+    if (idle)
+      break;
+    worked = true;
+  }
+
+  auto end = std::chrono::steady_clock::now();
+  stream->decodeTime += std::chrono::duration<float>(end - begin).count();
+  float elapsed = std::chrono::duration<float>(end - stream->loadStart).count();
+  if (elapsed >= 1.0f) {
+    stream->decodeLoad.store(stream->decodeTime / elapsed);
+    stream->decodeTime = 0.0f;
+    stream->loadStart = end;
+  }
+
+  return worked;
+}
+
+// 32 bit float stereo, the sizes are patched while recording
+static void writeWavHeader(FILE *f, int rate, size_t dataBytes) {
+  uint32_t riffSize = 36 + dataBytes;
+  uint32_t dataSize = dataBytes;
+  uint32_t fmtSize = 16;
+  uint16_t format = 3;
+  uint16_t channels = 2;
+  uint32_t sampleRate = rate;
+  uint32_t byteRate = rate * sizeof(Frame<2>);
+  uint16_t blockAlign = sizeof(Frame<2>);
+  uint16_t bits = 32;
+  fwrite("RIFF", 1, 4, f);
+  fwrite(&riffSize, 4, 1, f);
+  fwrite("WAVEfmt ", 1, 8, f);
+  fwrite(&fmtSize, 4, 1, f);
+  fwrite(&format, 2, 1, f);
+  fwrite(&channels, 2, 1, f);
+  fwrite(&sampleRate, 4, 1, f);
+  fwrite(&byteRate, 4, 1, f);
+  fwrite(&blockAlign, 2, 1, f);
+  fwrite(&bits, 2, 1, f);
+  fwrite("data", 1, 4, f);
+  fwrite(&dataSize, 4, 1, f);
+}
+
+float ANTNReader::read(ANTNStream *stream, float sampleRate, Frame<2> &frame) {
+  frame = {};
+  if (!stream->ready.load())
+    return 0.0f;
+
+  // Drop frames decoded for the previous station
+  int decodedGeneration = stream->decodedGeneration.load(std::memory_order_acquire);
+  SPSCRingBuffer<Frame<2>,262144> *ring = stream->dataAudioRingBuffer;
+  if (playedGeneration != decodedGeneration) {
+    // Keeps what the decoder already wrote for the new station
+    ring->flushTo(stream->decodedGenerationAt.load());
+    playedGeneration = decodedGeneration;
+    playedSplice = stream->frameSplice.load(std::memory_order_acquire);
+    splicePending = false;
+    crossfadeLength = 0;
+  }
+  if (playedGeneration != stream->generation.load())
+    return 0.0f;
+
+  // The stream reconnected, its audio starts at spliceFrame
+  int frameSplice = stream->frameSplice.load(std::memory_order_acquire);
+  if (frameSplice != playedSplice) {
+    playedSplice = frameSplice;
+    spliceFrame = stream->frameSpliceAt.load();
+    splicePending = true;
+    crossfadeLength = 0;
+  }
+  // Frames of the old connection left to play
+  size_t before = spliceFrame - ring->start.load(std::memory_order_relaxed);
+  if (splicePending) {
+    if ((before == 0) || (before > ring->size())) {
+      // Reached without enough new audio to crossfade, or flushed
+      splicePending = false;
+      crossfadeLength = 0;
+    }
+    else if ((crossfadeLength == 0) && (before <= ANTN_FADE_LENGTH) && (ring->size() >= 2 * before)) {
+      crossfadeLength = before;
+    }
+  }
+
+  float fade = stream->jitterBuffer.process(*ring, sampleRate);
+  if ((fade <= 0.0f) || !ring->shift(frame))
+    return 0.0f;
+  if (splicePending && (crossfadeLength > 0)) {
+    // Mix the end of the old connection with the start of the new one,
+    // which sits crossfadeLength frames further
+    const Frame<2> &newFrame = ring->startData()[crossfadeLength - 1];
+    float x = (float)(crossfadeLength - before) / crossfadeLength;
+    frame.samples[0] += x * (newFrame.samples[0] - frame.samples[0]);
+    frame.samples[1] += x * (newFrame.samples[1] - frame.samples[1]);
+    if (before == 1) {
+      // The new frames used by the crossfade are already played
+      ring->startIncr(crossfadeLength);
+      splicePending = false;
+      crossfadeLength = 0;
+    }
+  }
+  return fade;
+}
+
+std::mutex ANTNService::instanceMutex;
+ANTNService *ANTNService::instance = NULL;
+int ANTNService::users = 0;
+
+ANTNService::ANTNService() : streamsVersion(0), running(true) {
+  multi = curl_multi_init();
+  ioThread = thread(&ANTNService::ioTask, this);
+  recordThread = thread(&ANTNService::recordTask, this);
+  for (int i = 0; i < ANTN_DECODER_THREADS; i++) {
+    decoderThreads.push_back(thread(&ANTNService::decodeTask, this, i));
+  }
+}
+
+ANTNService::~ANTNService() {
+  running.store(false);
+  ioThread.join();
+  recordThread.join();
+  for (thread &t : decoderThreads) {
+    t.join();
+  }
+  curl_multi_cleanup(multi);
+}
+
+void ANTNService::add(std::shared_ptr<ANTNStream> stream) {
+  std::lock_guard<std::mutex> lock(instanceMutex);
+  if (users++ == 0)
+    instance = new ANTNService();
+  std::lock_guard<std::mutex> streamsLock(instance->mutex);
+  instance->streams.push_back(stream);
+  instance->streamsVersion++;
+}
+
+void ANTNService::remove(std::shared_ptr<ANTNStream> stream) {
+  std::lock_guard<std::mutex> lock(instanceMutex);
+  {
+    std::lock_guard<std::mutex> streamsLock(instance->mutex);
+    instance->streams.erase(std::remove(instance->streams.begin(), instance->streams.end(), stream), instance->streams.end());
+    instance->streamsVersion++;
+  }
+  if (--users == 0) {
+    delete instance;
+    instance = NULL;
+  }
+}
+
+void ANTNService::snapshot(vector<std::shared_ptr<ANTNStream>> &local, int &version) {
+  if (version != streamsVersion.load()) {
+    std::lock_guard<std::mutex> lock(mutex);
+    local = streams;
+    version = streamsVersion.load();
+  }
+}
+
+void ANTNService::startTransfer(ANTNStream *stream, const string &url) {
+  if (isLocal(url)) {
+    openFile(stream, localPath(url));
+    return;
+  }
+  stream->connectedAt = std::chrono::steady_clock::now();
+  stream->curl = curl_easy_init();
+  curl_easy_setopt(stream->curl, CURLOPT_SSL_VERIFYPEER, 0L);
+  curl_easy_setopt(stream->curl, CURLOPT_SSL_VERIFYHOST, 0L);
+  curl_easy_setopt(stream->curl, CURLOPT_FOLLOWLOCATION, 1L);
+  curl_easy_setopt(stream->curl, CURLOPT_NOSIGNAL, 1L);
+  curl_easy_setopt(stream->curl, CURLOPT_URL, url.c_str());
+  curl_easy_setopt(stream->curl, CURLOPT_WRITEFUNCTION, stream->resolving ? WriteUrlCallback : WriteMemoryCallback);
+  curl_easy_setopt(stream->curl, CURLOPT_WRITEDATA, stream);
+  curl_easy_setopt(stream->curl, CURLOPT_PRIVATE, stream);
+  stream->paused = false;
+  curl_multi_add_handle(multi, stream->curl);
+}
+
+void ANTNService::stopTransfer(ANTNStream *stream) {
+  if (stream->curl) {
+    curl_multi_remove_handle(multi, stream->curl);
+    curl_easy_cleanup(stream->curl);
+    stream->curl = NULL;
+  }
+  if (stream->file) {
+    fclose(stream->file);
+    stream->file = NULL;
+  }
+}
+
+void ANTNService::openFile(ANTNStream *stream, const string &path) {
+  stream->file = fopen(path.c_str(), "rb");
+  if (!stream->file) {
+    stream->eof.store(true, std::memory_order_release);
+    return;
+  }
+  if (stream->resolving) {
+    // Local playlists are small, resolve them right away
+    char buf[4096];
+    size_t n;
+    while ((n = fread(buf, 1, sizeof(buf), stream->file)) > 0) {
+      stream->secUrl.append(buf, n);
+    }
+    onTransferDone(stream);
+  }
+}
+
+// Reads as much of a local file as the byte ring can take, straight into
+// its free space. The ring being full is what paces the file to playback.
+void ANTNService::readFile(ANTNStream *stream) {
+  SPSCRingBuffer<char,262144> *bytes = stream->dataToDecodeRingBuffer;
+  size_t n = fread(bytes->endData(), 1, bytes->capacity(), stream->file);
+  bytes->endIncr(n);
+  if ((n == 0) && (feof(stream->file) || ferror(stream->file))) {
+    stopTransfer(stream);
+    stream->eof.store(true, std::memory_order_release);
+  }
+}
+
+void ANTNService::onTransferDone(ANTNStream *stream) {
+  stopTransfer(stream);
+  if (stream->resolving) {
+    stream->resolving = false;
+    string dir = isLocal(stream->ioUrl) ? directory(localPath(stream->ioUrl)) : "";
+    string zeUrl = parsePlaylist(stream->secUrl, extension(stream->ioUrl) == "pls", dir);
+    if (zeUrl != "") {
+      startTransfer(stream, zeUrl);
+      return;
+    }
+  }
+  stream->eof.store(true, std::memory_order_release);
+  if (!isLocal(stream->ioUrl))
+    scheduleReconnect(stream);
+}
+
+// The buffered audio keeps playing meanwhile
+void ANTNService::scheduleReconnect(ANTNStream *stream) {
+  auto now = std::chrono::steady_clock::now();
+  // A connection that lasted starts over from the shortest delay
+  if (now - stream->connectedAt > std::chrono::seconds(10))
+    stream->backoff = ANTN_RECONNECT_MIN;
+  stream->reconnecting = true;
+  stream->reconnectAt = now + std::chrono::milliseconds((int)(1000.0f * stream->backoff));
+  stream->backoff = min(stream->backoff * 2.0f, ANTN_RECONNECT_MAX);
+}
+
+void ANTNService::reconnect(ANTNStream *stream) {
+  stream->reconnecting = false;
+  stream->spliceAt.store(stream->dataToDecodeRingBuffer->end.load(std::memory_order_relaxed));
+  stream->splice.fetch_add(1, std::memory_order_release);
+  stream->eof.store(false);
+  stream->resolving = isPlaylist(stream->ioUrl);
+  stream->secUrl = "";
+  startTransfer(stream, stream->ioUrl);
+}
+
+void ANTNService::ioTask() {
+  vector<std::shared_ptr<ANTNStream>> local;
+  vector<std::shared_ptr<ANTNStream>> attached;
+  int version = -1;
+
+  while (running.load()) {
+    snapshot(local, version);
+
+    // Drop the transfers of streams whose module is gone
+    for (auto it = attached.begin(); it != attached.end(); ) {
+      if (std::find(local.begin(), local.end(), *it) == local.end()) {
+        stopTransfer(it->get());
+        it = attached.erase(it);
+      }
+      else {
+        it++;
+      }
+    }
+
+    for (std::shared_ptr<ANTNStream> &s : local) {
+      ANTNStream *stream = s.get();
+      int gen = stream->generation.load();
+      if (gen != stream->ioGen) {
+        stopTransfer(stream);
+        if (!stream->dataToDecodeRingBuffer) {
+          stream->dataToDecodeRingBuffer = new SPSCRingBuffer<char,262144>();
+          stream->dataAudioRingBuffer = new SPSCRingBuffer<Frame<2>,262144>();
+          stream->ready.store(true);
+        }
+        string url;
+        {
+          std::lock_guard<std::mutex> lock(stream->urlMutex);
+          url = stream->url;
+        }
+        stream->ioGen = gen;
+        stream->ioUrl = url;
+        stream->reconnecting = false;
+        stream->backoff = ANTN_RECONNECT_MIN;
+        stream->eof.store(false);
+        stream->ioGenerationAt.store(stream->dataToDecodeRingBuffer->end.load(std::memory_order_relaxed));
+        stream->ioGeneration.store(gen, std::memory_order_release);
+        stream->resolving = isPlaylist(url);
+        stream->secUrl = "";
+        startTransfer(stream, url);
+        if (std::find(attached.begin(), attached.end(), s) == attached.end())
+          attached.push_back(s);
+      }
+      else if (stream->curl && stream->paused && (stream->dataToDecodeRingBuffer->capacity() >= CURL_MAX_WRITE_SIZE)) {
+        stream->paused = false;
+        curl_easy_pause(stream->curl, CURLPAUSE_CONT);
+      }
+      else if (stream->file && !stream->dataToDecodeRingBuffer->full()) {
+        readFile(stream);
+      }
+      else if (stream->reconnecting && (std::chrono::steady_clock::now() >= stream->reconnectAt)) {
+        reconnect(stream);
+      }
+    }
+
+    int stillRunning = 0;
+    curl_multi_perform(multi, &stillRunning);
+
+    CURLMsg *msg;
+    int queued;
+    while ((msg = curl_multi_info_read(multi, &queued))) {
+      if (msg->msg == CURLMSG_DONE) {
+        char *priv = NULL;
+        curl_easy_getinfo(msg->easy_handle, CURLINFO_PRIVATE, &priv);
+        if (priv)
+          onTransferDone((ANTNStream *) priv);
+      }
+    }
+
+    int numfds = 0;
+    curl_multi_wait(multi, NULL, 0, 5, &numfds);
+    if (numfds == 0)
+      std::this_thread::sleep_for(std::chrono::milliseconds(2));
+  }
+
+  for (std::shared_ptr<ANTNStream> &s : attached) {
+    stopTransfer(s.get());
+  }
+}
+
+// Names the file after the current time, with a counter if that file exists
+void ANTNService::openRecording(ANTNStream *stream) {
+  char stamp[32];
+  time_t t = time(NULL);
+  strftime(stamp, sizeof(stamp), "%Y%m%d-%H%M%S", localtime(&t));
+  bool compressed = stream->recordingMode == RECORD_COMPRESSED;
+  string base = stream->recordingDir + "/antN-" + stamp;
+  string extension = compressed ? ".mp3" : ".wav";
+  string path = base + extension;
+  struct stat st;
+  for (int i = 2; stat(path.c_str(), &st) == 0; i++)
+    path = base + "-" + to_string(i) + extension;
+  stream->recordFile = fopen(path.c_str(), "wb");
+  if (!stream->recordFile)
+    return;
+  stream->recordBytes = 0;
+  stream->recordPatchedAt = std::chrono::steady_clock::now();
+  if (!compressed)
+    writeWavHeader(stream->recordFile, stream->recordRate, 0);
+}
+
+// Brings the wav header up to date and hands the file to the system, so
+// that what is on disk stays readable if the recording never gets closed
+void ANTNService::patchRecording(ANTNStream *stream) {
+  if (stream->recordingMode == RECORD_DECODED) {
+    fseek(stream->recordFile, 0, SEEK_SET);
+    writeWavHeader(stream->recordFile, stream->recordRate, stream->recordBytes);
+    fseek(stream->recordFile, 0, SEEK_END);
+  }
+  fflush(stream->recordFile);
+  stream->recordPatchedAt = std::chrono::steady_clock::now();
+}
+
+void ANTNService::closeRecording(ANTNStream *stream) {
+  patchRecording(stream);
+  fclose(stream->recordFile);
+  stream->recordFile = NULL;
+}
+
+void ANTNService::startRecording(ANTNStream *stream, int gen, int rate) {
+  stream->recordGen = gen;
+  stream->recordRate = rate;
+  openRecording(stream);
+  if (!stream->recordFile)
+    return;
+  if (stream->recordingMode == RECORD_COMPRESSED)
+    stream->dataToDecodeRingBuffer->tapEnable();
+  else
+    stream->dataAudioRingBuffer->tapEnable();
+}
+
+// Saves whatever the tap has not read yet and closes the file
+void ANTNService::stopRecording(ANTNStream *stream) {
+  if (!stream->recordFile)
+    return;
+  writeRecording(stream, SIZE_MAX);
+  if (stream->recordingMode == RECORD_COMPRESSED)
+    stream->dataToDecodeRingBuffer->tapDisable();
+  else
+    stream->dataAudioRingBuffer->tapDisable();
+  if (stream->recordFile)
+    closeRecording(stream);
+}
+
+// Writes what the tap has not read yet up to ring position at, straight
+// from the ring memory, returns true if there was anything. Decoded audio
+// goes on in a new file before the wav outgrows its header.
+bool ANTNService::writeRecording(ANTNStream *stream, size_t at) {
+  size_t total = 0;
+  if (stream->recordingMode == RECORD_COMPRESSED) {
+    SPSCRingBuffer<char,262144> *bytes = stream->dataToDecodeRingBuffer;
+    size_t n = min(bytes->tapSize(), at - bytes->tap.load(std::memory_order_relaxed));
+    fwrite(bytes->tapData(), 1, n, stream->recordFile);
+    bytes->tapIncr(n);
+    stream->recordBytes += n;
+    total = n;
+  }
+  else {
+    SPSCRingBuffer<Frame<2>,262144> *frames = stream->dataAudioRingBuffer;
+    while (stream->recordFile) {
+      size_t n = min(frames->tapSize(), at - frames->tap.load(std::memory_order_relaxed));
+      if (n == 0)
+        break;
+      size_t room = (ANTN_WAV_MAX_BYTES - stream->recordBytes) / sizeof(Frame<2>);
+      if (room == 0) {
+        closeRecording(stream);
+        openRecording(stream);
+        continue;
+      }
+      n = min(n, room);
+      fwrite(frames->tapData(), sizeof(Frame<2>), n, stream->recordFile);
+      frames->tapIncr(n);
+      stream->recordBytes += n * sizeof(Frame<2>);
+      total += n;
+    }
+  }
+  return total > 0;
+}
+
+bool ANTNService::recordStream(ANTNStream *stream) {
+  if (!stream->ready.load())
+    return false;
+
+  int version = stream->recordVersion.load();
+  if (version != stream->recordedVersion) {
+    stopRecording(stream);
+    std::lock_guard<std::mutex> lock(stream->recordMutex);
+    stream->recordingMode = stream->recordMode;
+    stream->recordingDir = stream->recordDir;
+    stream->recordedVersion = version;
+  }
+  if (stream->recordingMode == RECORD_OFF)
+    return false;
+
+  // The end of the data is read before the generation: the producers store
+  // where a new station starts and publish its generation before writing
+  // it, so data of a new station is never seen without its generation.
+  bool compressed = stream->recordingMode == RECORD_COMPRESSED;
+  size_t end = compressed ? stream->dataToDecodeRingBuffer->end.load(std::memory_order_acquire) : stream->dataAudioRingBuffer->end.load(std::memory_order_acquire);
+  int gen = compressed ? stream->ioGeneration.load(std::memory_order_acquire) : stream->decodedGeneration.load(std::memory_order_acquire);
+  size_t at = compressed ? stream->ioGenerationAt.load() : stream->decodedGenerationAt.load();
+  int rate = compressed ? 0 : (int)stream->sampleRate.load();
+
+  // A new file for each station: the old one ends exactly where the new
+  // station starts in the ring and the tap goes on from there
+  if (stream->recordFile && (gen != stream->recordGen)) {
+    writeRecording(stream, at);
+    if (stream->recordFile)
+      closeRecording(stream);
+    stream->recordGen = gen;
+    openRecording(stream);
+    if (!stream->recordFile) {
+      if (compressed)
+        stream->dataToDecodeRingBuffer->tapDisable();
+      else
+        stream->dataAudioRingBuffer->tapDisable();
+    }
+  }
+  // and for each engine rate when saving decoded audio
+  if (stream->recordFile && (rate != stream->recordRate))
+    stopRecording(stream);
+  if (!stream->recordFile) {
+    // Nothing to save before the first trigger
+    if (gen == 0)
+      return false;
+    startRecording(stream, gen, rate);
+    if (!stream->recordFile)
+      return false;
+  }
+
+  bool wrote = writeRecording(stream, end);
+  if (stream->recordFile && (std::chrono::steady_clock::now() - stream->recordPatchedAt >= std::chrono::duration<float>(ANTN_WAV_PATCH_INTERVAL)))
+    patchRecording(stream);
+  return wrote;
+}
+
+void ANTNService::recordTask() {
+  vector<std::shared_ptr<ANTNStream>> local;
+  vector<std::shared_ptr<ANTNStream>> attached;
+  int version = -1;
+
+  while (running.load()) {
+    snapshot(local, version);
+
+    // Close the files of streams whose module is gone
+    for (auto it = attached.begin(); it != attached.end(); ) {
+      if (std::find(local.begin(), local.end(), *it) == local.end()) {
+        stopRecording(it->get());
+        it = attached.erase(it);
+      }
+      else {
+        it++;
+      }
+    }
+
+    bool worked = false;
+    for (std::shared_ptr<ANTNStream> &s : local) {
+      worked |= recordStream(s.get());
+      if (s->recordFile && (std::find(attached.begin(), attached.end(), s) == attached.end()))
+        attached.push_back(s);
+    }
+    if (!worked)
+      std::this_thread::sleep_for(std::chrono::milliseconds(20));
+  }
+
+  for (std::shared_ptr<ANTNStream> &s : attached) {
+    stopRecording(s.get());
+  }
+}
+
+void ANTNService::decodeTask(int index) {
+  vector<std::shared_ptr<ANTNStream>> local;
+  int version = -1;
+  size_t next = index;
+
+  while (running.load()) {
+    snapshot(local, version);
+    bool worked = false;
+    for (size_t i = 0; i < local.size(); i++) {
+      ANTNStream *stream = local[(next + i) % local.size()].get();
+      // Another worker already has this one
+      if (!stream->decodeMutex.try_lock())
+        continue;
+      worked |= decodeStream(stream);
+      stream->decodeMutex.unlock();
+    }
+    next++;
+    if (!worked)
+      std::this_thread::sleep_for(std::chrono::milliseconds(1));
+  }
+}
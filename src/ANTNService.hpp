@@ -0,0 +1,522 @@
+#pragma once
+#include "util/math.hpp"
+#include "dsp/frame.hpp"
+#include "speex/speex_resampler.h"
+#include "curl/curl.h"
+#include "BidooRingBuffer.hpp"
+#include <cstdio>
+#include <cmath>
+#include <atomic>
+#include <string>
+#include <vector>
+#include <thread>
+#include <chrono>
+#include <mutex>
+#include <memory>
+#include <algorithm>
+#define MINIMP3_FLOAT_OUTPUT
+#include "dep/minimp3/minimp3.h"
+
+// ANTN's streaming pipeline, kept apart from the module so that the
+// offline benchmark (bench/ANTNBench.cpp) runs the same code without Rack:
+// nothing here calls into the engine or the app.
+
+// Quality below the speex range, selects plain linear interpolation
+const int ANTN_RESAMPLER_LINEAR = -1;
+// The drift correction is applied in steps of 1/ANTN_RATIO_STEPS of the
+// output rate, and each step becomes the closest ratio whose denominator
+// stays below ANTN_RATIO_MAX_DEN (within 5ppm of the step for the usual
+// rates). speex reduces the ratio with a loop bounded by the denominator and
+// rescales its phase with 32 bit products, both only safe on small terms.
+const int ANTN_RATIO_STEPS = 2048;
+const spx_uint32_t ANTN_RATIO_MAX_DEN = 4096;
+
+// Speex resampler driven directly rather than through SampleRateConverter,
+// so the ratio can be nudged for clock drift without rebuilding its state.
+// Input is interleaved with the stream's channel count, output is always
+// stereo: mono is resampled once into the left channel and copied right.
+// Quality 0 to 10 picks the speex filter, ANTN_RESAMPLER_LINEAR a linear
+// interpolator for machines where speex costs too much.
+struct ANTNResampler {
+  SpeexResamplerState *st = NULL;
+  int quality = 10;
+  int channels = 0;
+  int inRate = 0;
+  int outRate = 0;
+  spx_uint32_t ratioNum = 0;
+  spx_uint32_t ratioDen = 0;
+  // correction step currently applied, in 1/ANTN_RATIO_STEPS
+  int ratioStep = 0;
+  // linear interpolation state, position is relative to the last input frame
+  double position = 0.0;
+  rack::Frame<2> last = {};
+
+  ~ANTNResampler() {
+    if (st) speex_resampler_destroy(st);
+  }
+
+  void setQuality(int q) {
+    if (q == quality)
+      return;
+    if (st && (q != ANTN_RESAMPLER_LINEAR) && (quality != ANTN_RESAMPLER_LINEAR)) {
+      speex_resampler_set_quality(st, q);
+    }
+    else if (st) {
+      // Switching engines, setRates() starts the new one from scratch
+      speex_resampler_destroy(st);
+      st = NULL;
+    }
+    quality = q;
+  }
+
+  // Closest fraction to n/d with a denominator up to maxDen, from the
+  // continued fraction convergents of n/d and the last semiconvergent
+  static void closestRatio(uint64_t n, uint64_t d, uint64_t maxDen, spx_uint32_t *num, spx_uint32_t *den) {
+    double x = (double)n / d;
+    uint64_t p0 = 0, q0 = 1, p1 = 1, q1 = 0;
+    while (d) {
+      uint64_t a = n / d;
+      uint64_t q2 = q0 + a * q1;
+      if (q2 > maxDen) {
+        uint64_t k = (maxDen - q0) / q1;
+        uint64_t p = p0 + k * p1, q = q0 + k * q1;
+        if (fabs((double)p / q - x) < fabs((double)p1 / q1 - x)) {
+          p1 = p;
+          q1 = q;
+        }
+        break;
+      }
+      uint64_t p2 = p0 + a * p1;
+      p0 = p1; q0 = q1;
+      p1 = p2; q1 = q2;
+      uint64_t r = n - a * d;
+      n = d;
+      d = r;
+    }
+    *num = p1;
+    *den = q1;
+  }
+
+  // correction scales the output rate, >1 produces more frames per input frame.
+  // Only a change of the stream or engine rate rebuilds the state, the
+  // ratio only changes when the correction moves 3/4 of a step away from
+  // the applied one, so the slow wander of the jitter buffer's correction
+  // does not reach speex on every call.
+  void setRates(int channels, int inRate, int outRate, double correction) {
+    bool linear = quality == ANTN_RESAMPLER_LINEAR;
+    if ((!st && !linear) || (channels != this->channels) || (inRate != this->inRate) || (outRate != this->outRate)) {
+      if (st) speex_resampler_destroy(st);
+      st = NULL;
+      if (!linear) {
+        int err;
+        st = speex_resampler_init(channels, inRate, outRate, quality, &err);
+        if (channels == 1)
+          speex_resampler_set_output_stride(st, 2);
+      }
+      this->channels = channels;
+      this->inRate = inRate;
+      this->outRate = outRate;
+      position = 0.0;
+      last = {};
+      ratioNum = 0;
+      ratioDen = 0;
+    }
+    double step = (correction - 1.0) * ANTN_RATIO_STEPS;
+    if (fabs(step - ratioStep) > 0.75)
+      ratioStep = (int)round(step);
+    spx_uint32_t num, den;
+    closestRatio((uint64_t)inRate * ANTN_RATIO_STEPS, (uint64_t)outRate * (ANTN_RATIO_STEPS + ratioStep), ANTN_RATIO_MAX_DEN, &num, &den);
+    if ((num != ratioNum) || (den != ratioDen)) {
+      if (st)
+        speex_resampler_set_rate_frac(st, num, den, inRate, outRate);
+      ratioNum = num;
+      ratioDen = den;
+    }
+  }
+
+  // Forgets the previous input, used when the stream restarts
+  void reset() {
+    if (st) {
+      speex_resampler_reset_mem(st);
+      speex_resampler_skip_zeros(st);
+    }
+    position = 0.0;
+    last = {};
+  }
+
+  void process(const float *in, int *inFrames, rack::Frame<2> *out, int *outFrames) {
+    if (!st) {
+      processLinear(in, inFrames, out, outFrames);
+      return;
+    }
+    spx_uint32_t inLen = *inFrames;
+    spx_uint32_t outLen = *outFrames;
+    if (channels == 2) {
+      speex_resampler_process_interleaved_float(st, in, &inLen, (float*)out, &outLen);
+    }
+    else {
+      speex_resampler_process_float(st, 0, in, &inLen, (float*)out, &outLen);
+      for (spx_uint32_t i = 0; i < outLen; i++) {
+        out[i].samples[1] = out[i].samples[0];
+      }
+    }
+    *inFrames = inLen;
+    *outFrames = outLen;
+  }
+
+  // Input frame k sits at position k+1, last at 0
+  void processLinear(const float *in, int *inFrames, rack::Frame<2> *out, int *outFrames) {
+    double increment = (double)ratioNum / ratioDen;
+    // Right channel offset, 0 makes mono land on both sides
+    int right = channels - 1;
+    int o = 0;
+    while (o < *outFrames) {
+      int index = (int)position;
+      if (index >= *inFrames)
+        break;
+      float frac = position - index;
+      const float *b = in + index * channels;
+      float aL = (index == 0) ? last.samples[0] : b[-channels];
+      float aR = (index == 0) ? last.samples[1] : b[right - channels];
+      out[o].samples[0] = aL + frac * (b[0] - aL);
+      out[o].samples[1] = aR + frac * (b[right] - aR);
+      o++;
+      position += increment;
+    }
+    int consumed = std::min((int)position, *inFrames);
+    if (consumed > 0) {
+      last.samples[0] = in[(consumed - 1) * channels];
+      last.samples[1] = in[(consumed - 1) * channels + right];
+      position -= consumed;
+    }
+    *inFrames = consumed;
+    *outFrames = o;
+  }
+};
+
+const float ANTN_MAX_CORRECTION = 0.002f;
+const size_t ANTN_FADE_LENGTH = 512;
+// Compressed bytes kept ahead of the decoder before it has synced on a
+// stream with a recognizable header (10 frames at 320kbps fit)
+const size_t ANTN_DECODE_LOOKAHEAD = 16384;
+// Frames after the first header the decoder waits for before syncing
+const int ANTN_SYNC_FRAMES = 4;
+
+enum ANTNPrebufferPolicy {
+  PREBUFFER_MINIMAL,
+  PREBUFFER_BALANCED,
+  PREBUFFER_SAFE,
+  PREBUFFER_CUSTOM
+};
+// Seconds of decoded audio required before playback starts, per preset
+const float ANTN_PREBUFFER_PRESETS[3] = {0.15f, 0.5f, 1.5f};
+
+// Adaptive jitter buffer shared by the decoder thread and step().
+// step() owns the target (it raises it on every underrun and lowers it
+// after long stable periods), the decoder thread keeps the decoded fill
+// level near the target by slightly speeding up or slowing down the
+// resampler, which absorbs the drift between the stream and engine clocks.
+struct ANTNJitterBuffer {
+  // start threshold and lowest target, set from the prebuffer policy
+  std::atomic<float> prebuffer;
+  // seconds of decoded audio to keep ahead of the reader
+  std::atomic<float> target;
+  // resampler output rate factor currently applied by the decoder
+  std::atomic<float> correction;
+  std::atomic<int> rebuffers;
+
+  // decoder thread state
+  float smoothedFill = 0.0f;
+
+  // step() state
+  bool read = false;
+  float fade = 0.0f;
+  int stableSamples = 0;
+
+  // milliseconds from the trigger to the first audible frame, -1 until
+  // then, written by step() and read by the UI
+  std::atomic<float> timeToFirstAudio;
+  std::chrono::steady_clock::time_point startTime;
+
+  ANTNJitterBuffer() : prebuffer(ANTN_PREBUFFER_PRESETS[PREBUFFER_BALANCED]), target(ANTN_PREBUFFER_PRESETS[PREBUFFER_BALANCED]), correction(1.0f), rebuffers(0), timeToFirstAudio(-1.0f) {}
+
+  void setPrebuffer(float seconds) {
+    prebuffer.store(seconds);
+    target.store(seconds);
+  }
+
+  void reset() {
+    target.store(prebuffer.load());
+    correction.store(1.0f);
+    rebuffers.store(0);
+    read = false;
+    fade = 0.0f;
+    stableSamples = 0;
+    timeToFirstAudio.store(-1.0f);
+    startTime = std::chrono::steady_clock::now();
+  }
+
+  // Largest target that still leaves headroom for the decoder in a ring of the given size
+  static float maxTarget(size_t ringSize, float sampleRate) {
+    return 0.6f * ringSize / sampleRate;
+  }
+
+  float targetFrames(size_t ringSize, float sampleRate) {
+    return std::min(target.load(), maxTarget(ringSize, sampleRate)) * sampleRate;
+  }
+
+  // Decoder side, fill is the number of decoded frames waiting in the ring
+  float updateCorrection(size_t fill, size_t ringSize, float sampleRate, float dt) {
+    float targetFill = targetFrames(ringSize, sampleRate);
+    smoothedFill += (fill - smoothedFill) * std::min(dt / 5.0f, 1.0f);
+    float error = (smoothedFill - targetFill) / targetFill;
+    float c = 1.0f - rack::clamp(0.005f * error, -ANTN_MAX_CORRECTION, ANTN_MAX_CORRECTION);
+    correction.store(c);
+    return c;
+  }
+
+  // step() side, returns the gain to apply to the frame read from the ring
+  // or 0 while (re)buffering
+  template <typename R>
+  float process(R &ring, float sampleRate) {
+    size_t fill = ring.size();
+    if (!read) {
+      if (fill >= targetFrames(ring.maxSize(), sampleRate)) {
+        read = true;
+        stableSamples = 0;
+        if (timeToFirstAudio.load() < 0.0f)
+          timeToFirstAudio.store(std::chrono::duration<float, std::milli>(std::chrono::steady_clock::now() - startTime).count());
+      }
+      return 0.0f;
+    }
+
+    // Fade out on the last frames before the ring runs dry, back in when it refills
+    fade += (fill >= 2 * ANTN_FADE_LENGTH ? 1.0f : -1.0f) / ANTN_FADE_LENGTH;
+    if (fade <= 0.0f) {
+      fade = 0.0f;
+      read = false;
+      rebuffers++;
+      target.store(std::min(target.load() * 1.5f, maxTarget(ring.maxSize(), sampleRate)));
+      return 0.0f;
+    }
+    fade = std::min(fade, 1.0f);
+
+    if (++stableSamples > 60 * sampleRate) {
+      stableSamples = 0;
+      target.store(std::max(target.load() * 0.9f, prebuffer.load()));
+    }
+    return fade;
+  }
+};
+
+const int ANTN_DECODER_THREADS = 2;
+// mp3 frames a decoder worker handles for one stream before moving to the next
+const int ANTN_DECODE_QUOTA = 4;
+// Decoded frames waiting for the resampler
+const int ANTN_PCM_FRAMES = 4096;
+
+// Delay before reopening a dropped network stream, doubled on each failure
+const float ANTN_RECONNECT_MIN = 0.5f;
+const float ANTN_RECONNECT_MAX = 30.0f;
+
+// Largest data chunk a wav header can describe, a recording of decoded
+// audio goes on in a new file there
+const size_t ANTN_WAV_MAX_BYTES = (0xFFFFFFFFu - 36) / sizeof(rack::Frame<2>) * sizeof(rack::Frame<2>);
+// Seconds between two updates of the sizes in the header of a wav being recorded
+const float ANTN_WAV_PATCH_INTERVAL = 1.0f;
+
+enum ANTNRecordMode {
+  RECORD_OFF,
+  RECORD_COMPRESSED,
+  RECORD_DECODED
+};
+
+// One radio pipeline: compressed bytes -> minimp3 -> resampler -> decoded frames.
+// It is owned jointly by its ANTN instance and by ANTNService, whose I/O
+// thread feeds the byte ring and whose decoder pool fills the frame ring.
+// The rings are only allocated the first time the stream is triggered.
+//
+// Switching stations bumps generation from step(). The I/O thread
+// publishes ioGeneration once it no longer writes bytes of the previous
+// station, the decoder publishes decodedGeneration once it no longer writes
+// frames of the previous station, each with the ring position where the
+// new station starts (ioGenerationAt, decodedGenerationAt). Each consumer
+// drops what comes before that position and keeps what follows, so no
+// buffer ever has to be cleared or reallocated.
+//
+// A dropped connection is reopened within the same generation. The I/O
+// thread marks where the new connection starts in the byte ring (splice),
+// the decoder drains the old bytes up to there, restarts and marks the
+// matching position in the frame ring (frameSplice), where ANTNReader
+// crossfades from the old audio into the new one.
+struct ANTNStream {
+  rack::SPSCRingBuffer<char,262144> *dataToDecodeRingBuffer = NULL;
+  rack::SPSCRingBuffer<rack::Frame<2>,262144> *dataAudioRingBuffer = NULL;
+  std::atomic<bool> ready;
+  ANTNJitterBuffer jitterBuffer;
+
+  std::mutex urlMutex;
+  std::string url;
+  std::atomic<int> generation;
+  std::atomic<int> ioGeneration;
+  std::atomic<int> decodedGeneration;
+  // Ring positions where ioGeneration and decodedGeneration start, stored
+  // before the generation is published
+  std::atomic<size_t> ioGenerationAt;
+  std::atomic<size_t> decodedGenerationAt;
+  // Set by the I/O thread once the source of ioGeneration has no more bytes,
+  // the decoder then drains what is left below its lookahead
+  std::atomic<bool> eof;
+  std::atomic<int> splice;
+  std::atomic<size_t> spliceAt;
+  std::atomic<int> frameSplice;
+  std::atomic<size_t> frameSpliceAt;
+  // Share of the wall clock spent decoding and resampling this stream
+  std::atomic<float> decodeLoad;
+  std::atomic<int> resamplerQuality;
+  // Engine sample rate, set by the owner
+  std::atomic<float> sampleRate;
+
+  // I/O thread state
+  CURL *curl = NULL;
+  FILE *file = NULL;
+  int ioGen = 0;
+  std::string ioUrl;
+  bool resolving = false;
+  bool paused = false;
+  std::string secUrl;
+  bool reconnecting = false;
+  float backoff = ANTN_RECONNECT_MIN;
+  std::chrono::steady_clock::time_point connectedAt;
+  std::chrono::steady_clock::time_point reconnectAt;
+
+  // decoder state, guarded by decodeMutex
+  std::mutex decodeMutex;
+  int decoderGen = 0;
+  int decoderSplice = 0;
+  mp3dec_t mp3d;
+  // minimp3 float output, interleaved with pcmChannels, decoded in place
+  // and handed as is to the resampler
+  float *pcm = NULL;
+  int pcmFrames = 0;
+  int pcmChannels = 2;
+  ANTNResampler conv;
+  int hz = 0;
+  std::chrono::steady_clock::time_point lastUpdate;
+  std::chrono::steady_clock::time_point loadStart;
+  float decodeTime = 0.0f;
+
+  // Recording settings from the UI, guarded by recordMutex
+  std::mutex recordMutex;
+  int recordMode = RECORD_OFF;
+  std::string recordDir;
+  std::atomic<int> recordVersion;
+
+  // Recorder thread state: the file is fed from a tap on the byte ring
+  // (raw mp3) or on the frame ring (32 bit float wav)
+  int recordedVersion = 0;
+  int recordingMode = RECORD_OFF;
+  std::string recordingDir;
+  FILE *recordFile = NULL;
+  int recordGen = 0;
+  int recordRate = 0;
+  size_t recordBytes = 0;
+  std::chrono::steady_clock::time_point recordPatchedAt;
+
+  ANTNStream() : ready(false), generation(0), ioGeneration(0), decodedGeneration(0), ioGenerationAt(0), decodedGenerationAt(0), eof(false), splice(0), spliceAt(0), frameSplice(0), frameSpliceAt(0), decodeLoad(0.0f), resamplerQuality(10), sampleRate(44100.0f), recordVersion(0) {}
+
+  ~ANTNStream() {
+    delete dataToDecodeRingBuffer;
+    delete dataAudioRingBuffer;
+    delete[] pcm;
+  }
+
+  // Called from step(), hands a new url to the I/O thread
+  void request(const std::string &newUrl) {
+    {
+      std::lock_guard<std::mutex> lock(urlMutex);
+      url = newUrl;
+    }
+    generation++;
+  }
+
+  // Called from the UI, the recorder thread starts a new file
+  void record(int mode, const std::string &dir) {
+    {
+      std::lock_guard<std::mutex> lock(recordMutex);
+      recordMode = mode;
+      recordDir = dir;
+    }
+    recordVersion++;
+  }
+};
+
+// Playback side of a stream, called once per engine frame by its ANTN.
+// Drops the frames decoded for a previous station and crossfades where
+// the decoder restarted on a new connection.
+struct ANTNReader {
+  int playedGeneration = 0;
+  int playedSplice = 0;
+  bool splicePending = false;
+  size_t spliceFrame = 0;
+  size_t crossfadeLength = 0;
+
+  // Returns the gain to apply to frame, 0 while (re)buffering
+  float read(ANTNStream *stream, float sampleRate, rack::Frame<2> &frame);
+};
+
+// file:// urls and paths of existing files are read directly by the I/O
+// thread, anything else goes to libcurl, which also takes urls without a scheme
+bool isLocal(const std::string &url);
+// Removes the whitespace at both ends
+void trim(std::string &s);
+
+// Plugin-wide streaming service shared by every ANTN instance: a single
+// I/O thread drives all HTTP transfers through one libcurl multi handle,
+// reads local files straight into the byte rings, and a small pool of
+// decoder threads round-robins over the registered streams. A recorder
+// thread saves the streams being archived from taps on their rings.
+// It is started by the first ANTN and stopped with the last one.
+struct ANTNService {
+  std::mutex mutex;
+  std::vector<std::shared_ptr<ANTNStream>> streams;
+  std::atomic<int> streamsVersion;
+  std::atomic<bool> running;
+  std::thread ioThread;
+  std::thread recordThread;
+  std::vector<std::thread> decoderThreads;
+  CURLM *multi;
+
+  static std::mutex instanceMutex;
+  static ANTNService *instance;
+  static int users;
+
+  ANTNService();
+  ~ANTNService();
+
+  static void add(std::shared_ptr<ANTNStream> stream);
+  static void remove(std::shared_ptr<ANTNStream> stream);
+  void snapshot(std::vector<std::shared_ptr<ANTNStream>> &local, int &version);
+
+  // I/O thread
+  void startTransfer(ANTNStream *stream, const std::string &url);
+  void stopTransfer(ANTNStream *stream);
+  void openFile(ANTNStream *stream, const std::string &path);
+  void readFile(ANTNStream *stream);
+  void onTransferDone(ANTNStream *stream);
+  void scheduleReconnect(ANTNStream *stream);
+  void reconnect(ANTNStream *stream);
+  void ioTask();
+
+  // Recorder thread
+  void openRecording(ANTNStream *stream);
+  void patchRecording(ANTNStream *stream);
+  void closeRecording(ANTNStream *stream);
+  void startRecording(ANTNStream *stream, int gen, int rate);
+  void stopRecording(ANTNStream *stream);
+  bool writeRecording(ANTNStream *stream, size_t at);
+  bool recordStream(ANTNStream *stream);
+  void recordTask();
+
+  void decodeTask(int index);
+};
@@ -1,9 +1,96 @@
 #include "Bidoo.hpp"
 #include "BidooComponents.hpp"
-#include "dsp/ringbuffer.hpp"
+#include "BidooSlidingWindow.hpp"
+#include "dep/filters/truePeak.hpp"
+#include "dep/filters/crossover.hpp"
 
 using namespace std;
 
+#define BAR_CONTROL_RATE 16
+
+// log2 of a positive normal float: exponent from the bits and an atanh
+// series on the mantissa brought into [sqrt(0.5), sqrt(2)), within 2e-6.
+inline float fastLog2(float x) {
+	union { float f; int32_t i; } v;
+	v.f = x;
+	int32_t e = ((v.i >> 23) & 255) - 127;
+	v.i = (v.i & 0x007FFFFF) | 0x3F800000;
+	if (v.f > 1.41421356f) {
+		v.f *= 0.5f;
+		e++;
+	}
+	float s = (v.f - 1.0f) / (v.f + 1.0f);
+	float s2 = s * s;
+	float ln = 2.0f * s * (1.0f + s2 * (1.0f / 3.0f + s2 * (0.2f + s2 * (1.0f / 7.0f))));
+	return (float)e + ln * 1.44269504f;
+}
+
+// 2^x, the fraction left after rounding x to the nearest integer goes
+// through a Taylor series, within 3e-7 relative
+inline float fastExp2(float x) {
+	x = clamp(x, -126.0f, 126.0f);
+	int32_t i = (int32_t)(x + 126.5f) - 126;
+	float f = (x - (float)i) * 0.693147181f;
+	float p = 1.0f + f * (1.0f + f * (0.5f + f * (1.0f / 6.0f + f * (1.0f / 24.0f + f * (1.0f / 120.0f + f * (1.0f / 720.0f))))));
+	union { float f; int32_t i; } v;
+	v.f = p;
+	v.i += i << 23;
+	return v.f;
+}
+
+inline float fastDb(float x) {
+	return 6.02059991f * fastLog2(x);
+}
+
+inline float fastDbToGain(float dB) {
+	return fastExp2(dB * 0.166096405f);
+}
+
+// The same on four lanes
+inline __m128 fastLog2(__m128 x) {
+	__m128i i = _mm_castps_si128(x);
+	__m128i e = _mm_sub_epi32(_mm_and_si128(_mm_srli_epi32(i, 23), _mm_set1_epi32(255)), _mm_set1_epi32(127));
+	__m128 m = _mm_castsi128_ps(_mm_or_si128(_mm_and_si128(i, _mm_set1_epi32(0x007FFFFF)), _mm_set1_epi32(0x3F800000)));
+	__m128 big = _mm_cmpgt_ps(m, _mm_set1_ps(1.41421356f));
+	m = _mm_or_ps(_mm_and_ps(big, _mm_mul_ps(m, _mm_set1_ps(0.5f))), _mm_andnot_ps(big, m));
+	e = _mm_sub_epi32(e, _mm_castps_si128(big));
+	__m128 s = _mm_div_ps(_mm_sub_ps(m, _mm_set1_ps(1.0f)), _mm_add_ps(m, _mm_set1_ps(1.0f)));
+	__m128 s2 = _mm_mul_ps(s, s);
+	__m128 p = _mm_add_ps(_mm_set1_ps(0.2f), _mm_mul_ps(s2, _mm_set1_ps(1.0f / 7.0f)));
+	p = _mm_add_ps(_mm_set1_ps(1.0f / 3.0f), _mm_mul_ps(s2, p));
+	p = _mm_add_ps(_mm_set1_ps(1.0f), _mm_mul_ps(s2, p));
+	__m128 ln = _mm_mul_ps(_mm_mul_ps(_mm_set1_ps(2.0f), s), p);
+	return _mm_add_ps(_mm_cvtepi32_ps(e), _mm_mul_ps(ln, _mm_set1_ps(1.44269504f)));
+}
+
+inline __m128 fastExp2(__m128 x) {
+	x = _mm_max_ps(_mm_min_ps(x, _mm_set1_ps(126.0f)), _mm_set1_ps(-126.0f));
+	__m128i i = _mm_sub_epi32(_mm_cvttps_epi32(_mm_add_ps(x, _mm_set1_ps(126.5f))), _mm_set1_epi32(126));
+	__m128 f = _mm_mul_ps(_mm_sub_ps(x, _mm_cvtepi32_ps(i)), _mm_set1_ps(0.693147181f));
+	__m128 p = _mm_add_ps(_mm_set1_ps(1.0f / 120.0f), _mm_mul_ps(f, _mm_set1_ps(1.0f / 720.0f)));
+	p = _mm_add_ps(_mm_set1_ps(1.0f / 24.0f), _mm_mul_ps(f, p));
+	p = _mm_add_ps(_mm_set1_ps(1.0f / 6.0f), _mm_mul_ps(f, p));
+	p = _mm_add_ps(_mm_set1_ps(0.5f), _mm_mul_ps(f, p));
+	p = _mm_add_ps(_mm_set1_ps(1.0f), _mm_mul_ps(f, p));
+	p = _mm_add_ps(_mm_set1_ps(1.0f), _mm_mul_ps(f, p));
+	return _mm_castsi128_ps(_mm_add_epi32(_mm_castps_si128(p), _mm_slli_epi32(i, 23)));
+}
+
+inline __m128 fastDb(__m128 x) {
+	return _mm_mul_ps(_mm_set1_ps(6.02059991f), fastLog2(x));
+}
+
+inline __m128 fastDbToGain(__m128 dB) {
+	return fastExp2(_mm_mul_ps(dB, _mm_set1_ps(0.166096405f)));
+}
+
+inline __m128 blend(__m128 mask, __m128 a, __m128 b) {
+	return _mm_or_ps(_mm_and_ps(mask, a), _mm_andnot_ps(mask, b));
+}
+
+// Crossover points of the multiband modes, in Hz, 0 is single band
+static const float barCrossovers[4][2] = {{0.0f, 0.0f}, {120.0f, 1500.0f}, {200.0f, 2500.0f}, {300.0f, 5000.0f}};
+
 struct BAR : Module {
 	enum ParamIds {
 		THRESHOLD_PARAM,
@@ -31,121 +118,208 @@ struct BAR : Module {
 	enum LightIds {
 		NUM_LIGHTS
 	};
-	DoubleRingBuffer<float,16384> vu_L_Buffer, vu_R_Buffer;
-	DoubleRingBuffer<float,512> rms_L_Buffer, rms_R_Buffer;
-	float runningVU_L_Sum = 1e-6f, runningRMS_L_Sum = 1e-6f, rms_L = -96.3f, vu_L = -96.3f, peakL = -96.3f;
-	float runningVU_R_Sum = 1e-6f, runningRMS_R_Sum = 1e-6f, rms_R = -96.3f, vu_R = -96.3f, peakR = -96.3f;
+	// Squared dBFS of the detector input, rms and vu are only derived from
+	// them by updateMeters() when the display draws
+	SlidingWindow<16384> vu_L_Window, vu_R_Window;
+	SlidingWindow<512> rms_L_Window, rms_R_Window;
+	float rms_L = -96.3f, vu_L = -96.3f, peakL = -96.3f;
+	float rms_R = -96.3f, vu_R = -96.3f, peakR = -96.3f;
 	float in_L_dBFS = 1e-6f;
 	float in_R_dBFS = 1e-6f;
 	float dist = 0.0f, gain = 1.0f, gaindB = 1.0f, ratio = 1.0f, threshold = 1.0f, knee = 0.0f;
 	float attackTime = 0.0f, releaseTime = 0.0f, makeup = 1.0f, previousPostGain = 1.0f, mix = 1.0f;
-	int indexVU = 0, indexRMS = 0, lookAheadWriteIndex=0;
-	int maxIndexVU = 0, maxIndexRMS = 0, maxLookAheadWriteIndex=0;
+	int lookAheadWriteIndex=0, lookAheadMask=0;
 	int lookAhead;
-	float buffL[20000] = {0.0f}, buffR[20000] = {0.0f};
+	// Derived from the parameters every BAR_CONTROL_RATE samples, the
+	// exp() of the ballistics only when attack, release or rate changed
+	int controlCounter = 0, nbSamples = 0, delay = 0;
+	float cachedAttack = -1.0f, cachedRelease = -1.0f, cachedSampleRate = 0.0f;
+	float cAtt = 0.0f, cRel = 0.0f, slope = 0.0f, halfKnee = 0.0f, kneeScale = 0.0f, peakDecay = 0.0f;
+	// Detect on the 4x interpolated sidechain, set from the context menu.
+	// The audio is then delayed by the detector latency on top of the
+	// lookahead.
+	bool truePeak = false;
+	truePeakDetector truePeakL, truePeakR;
+	// Sized for the longest lookahead at the engine rate plus that latency
+	std::vector<float> buffL, buffR;
+	// Multiband mode, an index in barCrossovers set from the context menu.
+	// Each band has its own detector and gain computer with the shared
+	// settings, the three of them in the lanes of one vector. The detector
+	// splits the sidechain with a crossover of its own when it is patched
+	// or the audio is delayed.
+	int crossover = 0, cachedCrossover = 0;
+	crossover3 audioCrossover, detectorCrossover;
+	__m128 bandPostGain = _mm_setzero_ps();
 	BAR() : Module(NUM_PARAMS, NUM_INPUTS, NUM_OUTPUTS, NUM_LIGHTS) {
+		resizeLookAhead();
+		// start from silence
+		vu_L_Window.clear(96.3f*96.3f);
+		vu_R_Window.clear(96.3f*96.3f);
+		rms_L_Window.clear(96.3f*96.3f);
+		rms_R_Window.clear(96.3f*96.3f);
+	}
+
+	json_t *toJson() override {
+		json_t *rootJ = json_object();
+		json_object_set_new(rootJ, "truePeak", json_boolean(truePeak));
+		json_object_set_new(rootJ, "crossover", json_integer(crossover));
+		return rootJ;
 	}
 
+	void fromJson(json_t *rootJ) override {
+		json_t *truePeakJ = json_object_get(rootJ, "truePeak");
+		if (truePeakJ)
+			truePeak = json_is_true(truePeakJ);
+		json_t *crossoverJ = json_object_get(rootJ, "crossover");
+		if (crossoverJ)
+			crossover = clamp((int)json_integer_value(crossoverJ), 0, 3);
+	}
+
+	void resizeLookAhead();
+	void updateParams();
+	void updateMeters();
+	void setCrossovers();
+	void processBands(float scL, float scR, float inL, float inR);
 	void step() override;
+	void onSampleRateChange() override;
 
 };
 
-void BAR::step() {
-	if (indexVU>=16384) {
-		runningVU_L_Sum -= *vu_L_Buffer.startData();
-		runningVU_R_Sum -= *vu_R_Buffer.startData();
-		vu_L_Buffer.startIncr(1);
-		vu_R_Buffer.startIncr(1);
-		indexVU--;
+// The lookahead goes up to 200% of the longest attack, 100ms
+void BAR::resizeLookAhead() {
+	size_t length = (size_t)(0.2f * engineGetSampleRate()) + TRUE_PEAK_LATENCY + 1;
+	size_t size = 1;
+	while (size < length)
+		size <<= 1;
+	buffL.assign(size, 0.0f);
+	buffR.assign(size, 0.0f);
+	lookAheadMask = size - 1;
+	lookAheadWriteIndex = 0;
+}
+
+// The engine is not stepping the module here
+void BAR::onSampleRateChange() {
+	resizeLookAhead();
+	truePeakL.reset();
+	truePeakR.reset();
+	setCrossovers();
+}
+
+void BAR::setCrossovers() {
+	if (cachedCrossover > 0) {
+		float sampleRate = engineGetSampleRate();
+		audioCrossover.setFrequencies(barCrossovers[cachedCrossover][0] / sampleRate, barCrossovers[cachedCrossover][1] / sampleRate);
+		detectorCrossover.setFrequencies(barCrossovers[cachedCrossover][0] / sampleRate, barCrossovers[cachedCrossover][1] / sampleRate);
 	}
+	audioCrossover.reset();
+	detectorCrossover.reset();
+	bandPostGain = _mm_setzero_ps();
+}
 
-	if (indexRMS>=512) {
-		runningRMS_L_Sum -= *rms_L_Buffer.startData();
-		runningRMS_R_Sum -= *rms_R_Buffer.startData();
-		rms_L_Buffer.startIncr(1);
-		rms_R_Buffer.startIncr(1);
-		indexRMS--;
+void BAR::updateParams() {
+	threshold = params[THRESHOLD_PARAM].value;
+	attackTime = params[ATTACK_PARAM].value;
+	releaseTime = params[RELEASE_PARAM].value;
+	ratio = params[RATIO_PARAM].value;
+	knee = params[KNEE_PARAM].value;
+	makeup = params[MAKEUP_PARAM].value;
+	mix = params[MIX_PARAM].value;
+	lookAhead = params[LOOKAHEAD_PARAM].value;
+	if (crossover != cachedCrossover) {
+		cachedCrossover = crossover;
+		setCrossovers();
 	}
 
-	indexVU++;
-	indexRMS++;
+	float sampleRate = engineGetSampleRate();
+	if (attackTime != cachedAttack || sampleRate != cachedSampleRate)
+		cAtt = exp(-1.0f/(attackTime*sampleRate/1000.0f));
+	if (releaseTime != cachedRelease || sampleRate != cachedSampleRate)
+		cRel = exp(-1.0f/(releaseTime*sampleRate/1000.0f));
+	cachedAttack = attackTime;
+	cachedRelease = releaseTime;
+	cachedSampleRate = sampleRate;
+
+	slope = 1.0f/ratio-1.0f;
+	halfKnee = knee/2.0f;
+	kneeScale = knee > 0.0f ? slope/(2.0f * knee) : 0.0f;
+	peakDecay = 50.0f/sampleRate;
+	nbSamples = clamp(floor(lookAhead*attackTime*sampleRate/100000),0.0f,(float)(lookAheadMask-TRUE_PEAK_LATENCY));
+	delay = nbSamples + ((truePeak && cachedCrossover == 0) ? TRUE_PEAK_LATENCY : 0);
+}
+
+void BAR::updateMeters() {
+	rms_L = clamp(-1 * sqrtf(rms_L_Window.getMean()), -96.3f,0.0f);
+	vu_L = clamp(-1 * sqrtf(vu_L_Window.getMean()), -96.3f,0.0f);
+	rms_R = clamp(-1 * sqrtf(rms_R_Window.getMean()), -96.3f,0.0f);
+	vu_R = clamp(-1 * sqrtf(vu_R_Window.getMean()), -96.3f,0.0f);
+}
 
+void BAR::step() {
 	buffL[lookAheadWriteIndex]=inputs[IN_L_INPUT].value;
 	buffR[lookAheadWriteIndex]=inputs[IN_R_INPUT].value;
 
-	if (!inputs[SC_L_INPUT].active && inputs[IN_L_INPUT].active)
-		in_L_dBFS = max(20.0f*log10((abs(inputs[IN_L_INPUT].value)+1e-6f)/5.0f), -96.3f);
-	else if (inputs[SC_L_INPUT].active)
-		in_L_dBFS = max(20.0f*log10((abs(inputs[SC_L_INPUT].value)+1e-6f)/5.0f), -96.3f);
+	if (controlCounter-- <= 0) {
+		controlCounter = BAR_CONTROL_RATE - 1;
+		updateParams();
+	}
+
+	// the sidechain when patched, the input otherwise
+	float scL = inputs[SC_L_INPUT].active ? inputs[SC_L_INPUT].value : inputs[IN_L_INPUT].value;
+	float scR = inputs[SC_R_INPUT].active ? inputs[SC_R_INPUT].value : inputs[IN_R_INPUT].value;
+	// true peaks are only detected on the full band
+	bool truePeakDetection = truePeak && cachedCrossover == 0;
+	float levelL = truePeakDetection ? truePeakL.process(scL) : abs(scL);
+	float levelR = truePeakDetection ? truePeakR.process(scR) : abs(scR);
+
+	if (inputs[SC_L_INPUT].active || inputs[IN_L_INPUT].active)
+		in_L_dBFS = max(fastDb((levelL+1e-6f)/5.0f), -96.3f);
 	else
 		in_L_dBFS = -96.3f;
 
-	if (!inputs[SC_R_INPUT].active && inputs[IN_R_INPUT].active)
-		in_R_dBFS = max(20.0f*log10((abs(inputs[IN_R_INPUT].value)+1e-6f)/5.0f), -96.3f);
-	else if (inputs[SC_R_INPUT].active)
-		in_R_dBFS = max(20.0f*log10((abs(inputs[SC_R_INPUT].value)+1e-6f)/5.0f), -96.3f);
+	if (inputs[SC_R_INPUT].active || inputs[IN_R_INPUT].active)
+		in_R_dBFS = max(fastDb((levelR+1e-6f)/5.0f), -96.3f);
 	else
 		in_R_dBFS = -96.3f;
 
 	float data_L = in_L_dBFS*in_L_dBFS;
-
-	if (!vu_L_Buffer.full()) {
-		vu_L_Buffer.push(data_L);
-	}
-	if (!rms_L_Buffer.full()) {
-		rms_L_Buffer.push(data_L);
-	}
+	vu_L_Window.push(data_L);
+	rms_L_Window.push(data_L);
 
 	float data_R = in_R_dBFS*in_R_dBFS;
-	if (!vu_R_Buffer.full()) {
-		vu_R_Buffer.push(data_R);
-	}
-	if (!rms_R_Buffer.full()) {
-		rms_R_Buffer.push(data_R);
-	}
-
-	runningVU_L_Sum += data_L;
-	runningRMS_L_Sum += data_L;
-	runningVU_R_Sum += data_R;
-	runningRMS_R_Sum += data_R;
-	rms_L = clamp(-1 * sqrtf(runningRMS_L_Sum/512), -96.3f,0.0f);
-	vu_L = clamp(-1 * sqrtf(runningVU_L_Sum/16384), -96.3f,0.0f);
-	rms_R = clamp(-1 * sqrtf(runningRMS_R_Sum/512), -96.3f,0.0f);
-	vu_R = clamp(-1 * sqrtf(runningVU_R_Sum/16384), -96.3f,0.0f);
-	threshold = params[THRESHOLD_PARAM].value;
-	attackTime = params[ATTACK_PARAM].value;
-	releaseTime = params[RELEASE_PARAM].value;
-	ratio = params[RATIO_PARAM].value;
-	knee = params[KNEE_PARAM].value;
-	makeup = params[MAKEUP_PARAM].value;
+	vu_R_Window.push(data_R);
+	rms_R_Window.push(data_R);
 
 	if (in_L_dBFS>peakL)
 		peakL=in_L_dBFS;
 	else
-		peakL -= 50.0f/engineGetSampleRate();
+		peakL -= peakDecay;
 
 	if (in_R_dBFS>peakR)
 		peakR=in_R_dBFS;
 	else
-		peakR -= 50.0f/engineGetSampleRate();
+		peakR -= peakDecay;
+
+	int readIndex = (lookAheadWriteIndex-delay) & lookAheadMask;
+
+	if (cachedCrossover > 0) {
+		processBands(scL, scR, buffL[readIndex], buffR[readIndex]);
+		lookAheadWriteIndex = (lookAheadWriteIndex+1) & lookAheadMask;
+		return;
+	}
 
-	float slope = 1.0f/ratio-1.0f;
 	float maxIn = max(in_L_dBFS,in_R_dBFS);
 	float dist = maxIn-threshold;
-	float gcurve = 0.0f;
+	float preGain = 0.0f;
 
-	if (dist<-1.0f*knee/2.0f)
-		gcurve = maxIn;
-	else if ((dist > -1.0f*knee/2.0f) && (dist < knee/2.0f)) {
-		gcurve = maxIn + slope * pow(dist + knee/2.0f,2.0f)/(2.0f * knee);
+	if (dist<-1.0f*halfKnee)
+		preGain = 0.0f;
+	else if ((dist > -1.0f*halfKnee) && (dist < halfKnee)) {
+		preGain = kneeScale * (dist + halfKnee) * (dist + halfKnee);
 	} else {
-		gcurve = maxIn + slope * dist;
+		preGain = slope * dist;
 	}
 
-	float preGain = gcurve - maxIn;
 	float postGain = 0.0f;
-	float cAtt = exp(-1.0f/(attackTime*engineGetSampleRate()/1000.0f));
-	float cRel = exp(-1.0f/(releaseTime*engineGetSampleRate()/1000.0f));
 
 	if (preGain>previousPostGain) {
 		postGain = cAtt * previousPostGain + (1.0f-cAtt) * preGain;
@@ -155,23 +329,61 @@ void BAR::step() {
 
 	previousPostGain = postGain;
 	gaindB = makeup + postGain;
-	gain = pow(10.0f, gaindB/20.0f);
-
-	mix = params[MIX_PARAM].value;
-	lookAhead = params[LOOKAHEAD_PARAM].value;
-
-	int nbSamples = clamp(floor(lookAhead*attackTime*engineGetSampleRate()/100000),0.0f,19999.0f);
-	int readIndex;
-	if (lookAheadWriteIndex-nbSamples>=0)
-	  readIndex = (lookAheadWriteIndex-nbSamples)%20000;
-	else {
-		readIndex = 20000 - abs(lookAheadWriteIndex-nbSamples);
-	}
+	gain = fastDbToGain(gaindB);
 
 	outputs[OUT_L_OUTPUT].value = buffL[readIndex] * (gain*mix + (1.0f-mix));
 	outputs[OUT_R_OUTPUT].value = buffR[readIndex] * (gain*mix + (1.0f-mix));
 
-	lookAheadWriteIndex = (lookAheadWriteIndex+1)%20000;
+	lookAheadWriteIndex = (lookAheadWriteIndex+1) & lookAheadMask;
+}
+
+void BAR::processBands(float scL, float scR, float inL, float inR) {
+	__m128d audio[3], detector[3];
+	audioCrossover.process(inL, inR, audio);
+	if (delay > 0 || inputs[SC_L_INPUT].active || inputs[SC_R_INPUT].active)
+		detectorCrossover.process(scL, scR, detector);
+	else
+		for (int i = 0; i < 3; i++)
+			detector[i] = audio[i];
+
+	// low, mid and high bands in lanes 0 to 2, left and right apart
+	__m128 lowMid = _mm_movelh_ps(_mm_cvtpd_ps(audio[0]), _mm_cvtpd_ps(audio[1]));
+	__m128 high = _mm_cvtpd_ps(audio[2]);
+	__m128 bandsL = _mm_shuffle_ps(lowMid, high, _MM_SHUFFLE(2, 0, 2, 0));
+	__m128 bandsR = _mm_shuffle_ps(lowMid, high, _MM_SHUFFLE(3, 1, 3, 1));
+	lowMid = _mm_movelh_ps(_mm_cvtpd_ps(detector[0]), _mm_cvtpd_ps(detector[1]));
+	high = _mm_cvtpd_ps(detector[2]);
+	__m128 signMask = _mm_set1_ps(-0.0f);
+	__m128 level = _mm_max_ps(_mm_andnot_ps(signMask, _mm_shuffle_ps(lowMid, high, _MM_SHUFFLE(2, 0, 2, 0))),
+		_mm_andnot_ps(signMask, _mm_shuffle_ps(lowMid, high, _MM_SHUFFLE(3, 1, 3, 1))));
+
+	__m128 bandIn = _mm_max_ps(fastDb(_mm_mul_ps(_mm_add_ps(level, _mm_set1_ps(1e-6f)), _mm_set1_ps(0.2f))), _mm_set1_ps(-96.3f));
+	__m128 dist = _mm_sub_ps(bandIn, _mm_set1_ps(threshold));
+	__m128 hk = _mm_set1_ps(halfKnee);
+	__m128 kneeDist = _mm_add_ps(dist, hk);
+	__m128 inKnee = _mm_and_ps(_mm_cmpgt_ps(dist, _mm_sub_ps(_mm_setzero_ps(), hk)), _mm_cmplt_ps(dist, hk));
+	__m128 preGain = blend(inKnee, _mm_mul_ps(_mm_set1_ps(kneeScale), _mm_mul_ps(kneeDist, kneeDist)), _mm_mul_ps(_mm_set1_ps(slope), dist));
+	preGain = _mm_andnot_ps(_mm_cmplt_ps(dist, _mm_sub_ps(_mm_setzero_ps(), hk)), preGain);
+
+	__m128 c = blend(_mm_cmpgt_ps(preGain, bandPostGain), _mm_set1_ps(cAtt), _mm_set1_ps(cRel));
+	bandPostGain = _mm_add_ps(_mm_mul_ps(c, bandPostGain), _mm_mul_ps(_mm_sub_ps(_mm_set1_ps(1.0f), c), preGain));
+	__m128 bandGain = fastDbToGain(_mm_add_ps(_mm_set1_ps(makeup), bandPostGain));
+	__m128 w = _mm_add_ps(_mm_mul_ps(bandGain, _mm_set1_ps(mix)), _mm_set1_ps(1.0f - mix));
+
+	__m128 outL = _mm_mul_ps(bandsL, w);
+	__m128 outR = _mm_mul_ps(bandsR, w);
+	__m128 sum = _mm_add_ps(_mm_movelh_ps(outL, outR), _mm_movehl_ps(outR, outL));
+	sum = _mm_add_ps(sum, _mm_shuffle_ps(sum, sum, _MM_SHUFFLE(2, 3, 0, 1)));
+	float out[4];
+	_mm_storeu_ps(out, sum);
+	outputs[OUT_L_OUTPUT].value = out[0];
+	outputs[OUT_R_OUTPUT].value = out[2];
+
+	// the display shows the band reduced the most
+	float post[4];
+	_mm_storeu_ps(post, bandPostGain);
+	gaindB = makeup + min(post[0], min(post[1], post[2]));
+	gain = fastDbToGain(gaindB);
 }
 
 struct BARDisplay : TransparentWidget {
@@ -182,6 +394,7 @@ struct BARDisplay : TransparentWidget {
 	}
 
 void draw(NVGcontext *vg) override {
+	module->updateMeters();
 	float height = 150.0f;
 	float width = 15.0f;
 	float spacer = 3.0f;
@@ -287,6 +500,8 @@ void draw(NVGcontext *vg) override {
 
 
 struct BARWidget : ModuleWidget {
+	Menu *createContextMenu() override;
+
 	BARWidget(BAR *module) : ModuleWidget(module) {
 		setPanel(SVG::load(assetPlugin(plugin, "res/BAR.svg")));
 
@@ -319,4 +534,57 @@ struct BARWidget : ModuleWidget {
 	}
 };
 
+struct BARTruePeakItem : MenuItem {
+	BAR *barModule;
+	void onAction(EventAction &e) override {
+		barModule->truePeak = !barModule->truePeak;
+	}
+	void step() override {
+		rightText = barModule->truePeak ? "✔" : "";
+		MenuItem::step();
+	}
+};
+
+struct BARCrossoverItem : MenuItem {
+	BAR *barModule;
+	int crossover;
+	void onAction(EventAction &e) override {
+		barModule->crossover = crossover;
+	}
+	void step() override {
+		rightText = (barModule->crossover == crossover) ? "✔" : "";
+		MenuItem::step();
+	}
+};
+
+Menu *BARWidget::createContextMenu() {
+	Menu *menu = ModuleWidget::createContextMenu();
+
+	BAR *barModule = dynamic_cast<BAR*>(module);
+	assert(barModule);
+
+	MenuLabel *spacerLabel = new MenuLabel();
+	menu->addChild(spacerLabel);
+
+	BARTruePeakItem *truePeakItem = new BARTruePeakItem();
+	truePeakItem->text = "True peak detection";
+	truePeakItem->barModule = barModule;
+	menu->addChild(truePeakItem);
+
+	MenuLabel *bandsLabel = new MenuLabel();
+	bandsLabel->text = "Bands";
+	menu->addChild(bandsLabel);
+
+	static const char *crossoverNames[4] = {"Single band", "3 bands, 120Hz / 1.5kHz", "3 bands, 200Hz / 2.5kHz", "3 bands, 300Hz / 5kHz"};
+	for (int i = 0; i < 4; i++) {
+		BARCrossoverItem *crossoverItem = new BARCrossoverItem();
+		crossoverItem->text = crossoverNames[i];
+		crossoverItem->barModule = barModule;
+		crossoverItem->crossover = i;
+		menu->addChild(crossoverItem);
+	}
+
+	return menu;
+}
+
 Model *modelBAR = Model::create<BAR, BARWidget>("Bidoo", "baR", "bAR compressor", DYNAMICS_TAG);
@@ -0,0 +1,160 @@
+#pragma once
+#include <atomic>
+#include <cstring>
+#include <cstddef>
+
+namespace rack {
+
+// Lock-free single producer / single consumer ring buffer.
+// Like DoubleRingBuffer the storage is mirrored (element i lives at i and
+// i+S), so the readable region starting at startData() and the writable
+// region starting at endData() are always contiguous. This lets a consumer
+// decode in place and a producer resample straight into the buffer.
+// The producer publishes with a release store on end, the consumer with a
+// release store on start, each side reads the other index with acquire.
+// An optional tap is a second reader trailing the consumer: while it is
+// enabled the producer does not overwrite what the tap has not read, so a
+// background thread can save the same elements in place without a copy.
+// S must be a power of 2, T must be trivially copyable.
+template <typename T, size_t S>
+struct SPSCRingBuffer {
+	T data[2*S];
+	std::atomic<size_t> start;
+	std::atomic<size_t> end;
+	// elements the producer could not write because the buffer was full
+	std::atomic<size_t> overflows;
+	// reads attempted by the consumer while the buffer was empty
+	std::atomic<size_t> underruns;
+	std::atomic<size_t> tap;
+	std::atomic<bool> tapped;
+
+	SPSCRingBuffer() : start(0), end(0), overflows(0), underruns(0), tap(0), tapped(false) {}
+
+	size_t mask(size_t i) const {
+		return i & (S - 1);
+	}
+	size_t maxSize() const {
+		return S;
+	}
+
+	// Consumer side
+
+	size_t size() const {
+		return end.load(std::memory_order_acquire) - start.load(std::memory_order_relaxed);
+	}
+	bool empty() const {
+		return size() == 0;
+	}
+	// Valid for size() contiguous elements
+	const T *startData() const {
+		return &data[mask(start.load(std::memory_order_relaxed))];
+	}
+	void startIncr(size_t n) {
+		start.store(start.load(std::memory_order_relaxed) + n, std::memory_order_release);
+	}
+	// Drops everything readable, safe while the producer is running
+	void flush() {
+		start.store(end.load(std::memory_order_acquire), std::memory_order_release);
+	}
+	// Drops what is readable before position i, which is left as is if
+	// it is past the end or already read. Safe while the producer is running.
+	void flushTo(size_t i) {
+		size_t s = start.load(std::memory_order_relaxed);
+		if (i - s <= end.load(std::memory_order_acquire) - s)
+			start.store(i, std::memory_order_release);
+	}
+	bool shift(T &t) {
+		if (empty()) {
+			underruns.fetch_add(1, std::memory_order_relaxed);
+			return false;
+		}
+		t = *startData();
+		startIncr(1);
+		return true;
+	}
+
+	// Producer side
+
+	size_t capacity() const {
+		size_t e = end.load(std::memory_order_relaxed);
+		size_t s = start.load(std::memory_order_acquire);
+		if (tapped.load(std::memory_order_acquire)) {
+			size_t t = tap.load(std::memory_order_acquire);
+			// The slowest reader bounds the free space
+			if (e - t > e - s)
+				s = t;
+		}
+		return S - (e - s);
+	}
+	bool full() const {
+		return capacity() == 0;
+	}
+	// Valid for capacity() contiguous elements
+	T *endData() {
+		return &data[mask(end.load(std::memory_order_relaxed))];
+	}
+	void endIncr(size_t n) {
+		size_t e = end.load(std::memory_order_relaxed);
+		size_t e0 = mask(e);
+		size_t e1 = e0 + n;
+		size_t e2 = (e1 < S) ? e1 : S;
+		// Mirror what was written so both halves hold the same elements
+		std::memcpy(data + S + e0, data + e0, sizeof(T) * (e2 - e0));
+		if (e1 > S)
+			std::memcpy(data, data + S, sizeof(T) * (e1 - S));
+		end.store(e + n, std::memory_order_release);
+	}
+	bool push(const T &t) {
+		if (full()) {
+			overflows.fetch_add(1, std::memory_order_relaxed);
+			return false;
+		}
+		*endData() = t;
+		endIncr(1);
+		return true;
+	}
+	// Writes as many elements as fit and returns that count, the rest is
+	// accounted as overflow.
+	size_t write(const T *t, size_t n) {
+		size_t c = capacity();
+		size_t w = (n < c) ? n : c;
+		std::memcpy(endData(), t, sizeof(T) * w);
+		endIncr(w);
+		if (w < n)
+			overflows.fetch_add(n - w, std::memory_order_relaxed);
+		return w;
+	}
+
+	// Tap side
+
+	// Starts reading from what the producer writes next
+	void tapEnable() {
+		tap.store(end.load(std::memory_order_acquire), std::memory_order_release);
+		tapped.store(true, std::memory_order_release);
+	}
+	void tapDisable() {
+		tapped.store(false, std::memory_order_release);
+	}
+	size_t tapSize() const {
+		return end.load(std::memory_order_acquire) - tap.load(std::memory_order_relaxed);
+	}
+	// Valid for tapSize() contiguous elements
+	const T *tapData() const {
+		return &data[mask(tap.load(std::memory_order_relaxed))];
+	}
+	void tapIncr(size_t n) {
+		tap.store(tap.load(std::memory_order_relaxed) + n, std::memory_order_release);
+	}
+
+	// Only safe while neither the producer nor the consumer is running
+	void clear() {
+		start.store(0);
+		end.store(0);
+	}
+	void resetCounters() {
+		overflows.store(0);
+		underruns.store(0);
+	}
+};
+
+}
@@ -0,0 +1,60 @@
+#pragma once
+#include <cstddef>
+
+namespace rack {
+
+// Sum and mean of the last S values pushed, the ones before the first push
+// counting as the value given to clear(), 0 by default. The window is a
+// plain circular buffer of S elements.
+// A running sum updated by adding the new value and removing the oldest
+// one drifts over a long session. Here it is kept in double, and rebased
+// each time the write index wraps around: by then the buffer only holds
+// the values pushed since the previous wrap, whose plain sum (lap) is kept
+// alongside, so the rebase is one assignment rather than a pass over the
+// buffer on the audio thread. This bounds the error to what a single window
+// can accumulate. (A Kahan compensation term would not survive the
+// -funsafe-math-optimizations Rack is built with.)
+// S must be a power of 2.
+template <size_t S>
+struct SlidingWindow {
+	float data[S];
+	size_t pos;
+	double sum;
+	// sum of data[0] to data[pos - 1], pushed since the index last wrapped
+	double lap;
+
+	SlidingWindow() {
+		clear();
+	}
+
+	void clear(float t = 0.0f) {
+		for (size_t i = 0; i < S; i++)
+			data[i] = t;
+		pos = 0;
+		sum = (double)t * S;
+		lap = 0.0;
+	}
+
+	void push(float t) {
+		sum += (double)t - (double)data[pos];
+		lap += t;
+		data[pos] = t;
+		pos = (pos + 1) & (S - 1);
+		if (pos == 0) {
+			sum = lap;
+			lap = 0.0;
+		}
+	}
+
+	float getSum() const {
+		return (float)sum;
+	}
+	float getMean() const {
+		return (float)(sum / S);
+	}
+	size_t size() const {
+		return S;
+	}
+};
+
+}
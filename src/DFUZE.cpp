@@ -1,12 +1,156 @@
 #include "Bidoo.hpp"
 #include "BidooComponents.hpp"
-#include "dsp/ringbuffer.hpp"
 #include "dep/freeverb/revmodel.hpp"
-#include "dep/filters/smbPitchShift.hpp"
+#include "dep/filters/fftPitchShift.hpp"
 #include "dsp/digital.hpp"
+#include "dsp/frame.hpp"
+#include "BidooRingBuffer.hpp"
+#include <atomic>
+#include <thread>
+#include <chrono>
 
 using namespace std;
 
+#define DFUZE_WORKER_BLOCK 512
+#define DFUZE_BLOCK 32
+
+// The audible shimmer voices packed for the shifters: their ratios, their
+// gains and how many there are
+struct DFUZEShimmerParams {
+	float ratios[FFT_PITCH_SHIFT_MAX_VOICES] = {2.0f};
+	float gains[FFT_PITCH_SHIFT_MAX_VOICES] = {1.0f};
+	int voices = 1;
+};
+
+// Hands the latest voices from the UI to the audio thread. Three slots: the
+// writer fills its own and swaps it with the middle one, the reader swaps
+// its own with the middle one when it holds something new, so neither side
+// waits and the reader never sees a half written value.
+struct DFUZEShimmerMailbox {
+	DFUZEShimmerParams slots[3];
+	int back = 0;
+	int front = 1;
+	// index of the middle slot, or'ed with 4 while it has not been read
+	std::atomic<int> middle;
+
+	DFUZEShimmerMailbox() : middle(2) {}
+
+	void write(const DFUZEShimmerParams &params) {
+		slots[back] = params;
+		back = middle.exchange(back | 4) & 3;
+	}
+
+	bool read(DFUZEShimmerParams &params) {
+		if (!(middle.load() & 4))
+			return false;
+		front = middle.exchange(front) & 3;
+		params = slots[front];
+		return true;
+	}
+};
+
+// Runs the shimmer pitch shifting on its own thread. step() pushes the wet
+// signal into input and pops the shifted one from output, which starts
+// with two blocks of silence: the worker has a whole block period to
+// shift each block, and the shimmer comes back a fixed 2*DFUZE_WORKER_BLOCK
+// frames late. Off the audio thread the frames can be twice as long.
+// The voices come as snapshots through params and apply from the next
+// block on, the worker never reads the module.
+struct DFUZEShimmerWorker {
+	SPSCRingBuffer<Frame<2>,4096> input;
+	SPSCRingBuffer<Frame<2>,4096> output;
+	SPSCRingBuffer<DFUZEShimmerParams,16> params;
+	DFUZEShimmerParams shimmer;
+	fftPitchShifter shifterL, shifterR;
+	// bumped by the module to have the shifters cleared before the next block
+	std::atomic<unsigned int> resets;
+	unsigned int resetsDone = 0;
+	// frames step() could not pop, dropped from output once they arrive
+	size_t missed = 0;
+	std::atomic<bool> running;
+	// set by retire(), the thread then deletes the worker itself
+	bool retired = false;
+	thread worker;
+
+	DFUZEShimmerWorker() : shifterL(4096, 4), shifterR(4096, 4), resets(0), running(true) {
+		Frame<2> silence = {};
+		for (int i = 0; i < 2 * DFUZE_WORKER_BLOCK; i++) {
+			output.push(silence);
+		}
+		worker = thread(&DFUZEShimmerWorker::run, this);
+	}
+
+	~DFUZEShimmerWorker() {
+		if (worker.joinable()) {
+			running.store(false);
+			worker.join();
+		}
+	}
+
+	// Stops the worker without waiting for it, it is deleted by its own
+	// thread once the current block is done. Nothing may use it afterwards.
+	void retire() {
+		worker.detach();
+		retired = true;
+		running.store(false);
+	}
+
+	void run() {
+		float l[DFUZE_WORKER_BLOCK], r[DFUZE_WORKER_BLOCK];
+		while (running.load()) {
+			// Only the latest voices matter
+			while (!params.empty())
+				params.shift(shimmer);
+			if ((input.size() < DFUZE_WORKER_BLOCK) || (output.capacity() < DFUZE_WORKER_BLOCK)) {
+				std::this_thread::sleep_for(std::chrono::milliseconds(1));
+				continue;
+			}
+			unsigned int requested = resets.load();
+			if (requested != resetsDone) {
+				shifterL.reset();
+				shifterR.reset();
+				resetsDone = requested;
+			}
+			const Frame<2> *in = input.startData();
+			for (int i = 0; i < DFUZE_WORKER_BLOCK; i++) {
+				l[i] = in[i].samples[0];
+				r[i] = in[i].samples[1];
+			}
+			input.startIncr(DFUZE_WORKER_BLOCK);
+			shifterL.process(shimmer.ratios, shimmer.gains, shimmer.voices, DFUZE_WORKER_BLOCK, l, l);
+			shifterR.process(shimmer.ratios, shimmer.gains, shimmer.voices, DFUZE_WORKER_BLOCK, r, r);
+			Frame<2> *out = output.endData();
+			for (int i = 0; i < DFUZE_WORKER_BLOCK; i++) {
+				out[i].samples[0] = l[i];
+				out[i].samples[1] = r[i];
+			}
+			output.endIncr(DFUZE_WORKER_BLOCK);
+		}
+		if (retired)
+			delete this;
+	}
+
+	// Audio thread side, one frame in and one frame out per step
+	void process(float wetL, float wetR, float &shimmerL, float &shimmerR) {
+		Frame<2> wet = {{wetL, wetR}};
+		input.push(wet);
+		// Keep the latency fixed if the worker fell behind
+		size_t skip = min(missed, output.size());
+		output.startIncr(skip);
+		missed -= skip;
+		Frame<2> shimmer;
+		if (output.shift(shimmer)) {
+			shimmerL = shimmer.samples[0];
+			shimmerR = shimmer.samples[1];
+		}
+		else {
+			shimmerL = 0.0f;
+			shimmerR = 0.0f;
+			missed++;
+		}
+	}
+};
+
 struct DFUZE : Module {
 	enum ParamIds {
 		SIZE_PARAM,
@@ -36,75 +180,222 @@ struct DFUZE : Module {
 	enum LightIds {
 		NUM_LIGHTS
 	};
-	DoubleRingBuffer<float,4096> in_L_Buffer, in_R_Buffer;
-	DoubleRingBuffer<float,4096> pin_L_Buffer, pin_R_Buffer;
 	revmodel revprocessor;
+	// The reverb runs on blocks of DFUZE_BLOCK frames, collected here while
+	// the previous block plays, so the wet signal is DFUZE_BLOCK frames late.
+	// The reverb's own dry mix stays at 0, step() adds the dry signal as it
+	// comes in.
+	float blockInL[DFUZE_BLOCK] = {}, blockInR[DFUZE_BLOCK] = {};
+	float blockOutL[DFUZE_BLOCK] = {}, blockOutR[DFUZE_BLOCK] = {};
+	int blockPos = 0;
+	// The shimmer is streamed, each shifter runs one STFT hop every 512 samples.
+	// A block's shimmer feeds the reverb back on the next block.
+	fftPitchShifter pitchShifterL, pitchShifterR;
+	float shimmerL[DFUZE_BLOCK] = {}, shimmerR[DFUZE_BLOCK] = {};
+	// Shimmer intervals in semitones and their gains, a gain of 0 mutes the
+	// voice. Edited from the UI, which packs them into shimmerMailbox.
+	float shimmerSemitones[FFT_PITCH_SHIFT_MAX_VOICES] = {12.0f, 7.0f, -12.0f};
+	float shimmerGains[FFT_PITCH_SHIFT_MAX_VOICES] = {1.0f, 0.0f, 0.0f};
+	DFUZEShimmerMailbox shimmerMailbox;
+	// The voices the audio thread runs, and whether the worker still lacks them
+	DFUZEShimmerParams shimmer;
+	bool shimmerPending = false;
+	// The UI asks for the worker with shimmerThreaded and leaves a new one in
+	// spareWorker, the audio thread adopts it as shimmerWorker and retires
+	// it once the UI no longer wants it, see setShimmerWorker()
+	std::atomic<bool> shimmerThreaded;
+	std::atomic<DFUZEShimmerWorker*> spareWorker;
+	DFUZEShimmerWorker *shimmerWorker = NULL;
 	SchmittTrigger freezeTrigger;
 	bool freeze = false;
-	float sr = engineGetSampleRate();
 
-	DFUZE() : Module(NUM_PARAMS, NUM_INPUTS, NUM_OUTPUTS, NUM_LIGHTS) {
+	DFUZE() : Module(NUM_PARAMS, NUM_INPUTS, NUM_OUTPUTS, NUM_LIGHTS), revprocessor(engineGetSampleRate()), pitchShifterL(2048, 4), pitchShifterR(2048, 4), shimmerThreaded(false), spareWorker(NULL) {
+		revprocessor.setdry(0.0f);
+		staggerShifters();
+	}
+
+	// The engine no longer steps the module, both workers can be joined here
+	~DFUZE() {
+		delete shimmerWorker;
+		delete spareWorker.load();
+	}
+
+	bool isShimmerThreaded() {
+		return shimmerThreaded.load();
+	}
 
+	// Called from the UI, never waits on the audio thread. A worker the
+	// audio thread did not adopt yet is retired here, the adopted one is
+	// retired by the audio thread on its next block.
+	void setShimmerWorker(bool threaded) {
+		if (threaded && !shimmerThreaded.exchange(true)) {
+			DFUZEShimmerWorker *worker = spareWorker.exchange(new DFUZEShimmerWorker());
+			if (worker)
+				worker->retire();
+		}
+		else if (!threaded && shimmerThreaded.exchange(false)) {
+			DFUZEShimmerWorker *worker = spareWorker.exchange(NULL);
+			if (worker)
+				worker->retire();
+		}
 	}
 
+	// Half a hop of silence into the right shifter, so the two channels
+	// never run their FFTs on the same step
+	void staggerShifters() {
+		float silence[256] = {};
+		pitchShifterR.process(2.0f, 256, silence, silence);
+	}
+
+	// Packs the audible voices for the shifters
+	void updateShimmer() {
+		DFUZEShimmerParams params;
+		int n = 0;
+		for (int i = 0; i < FFT_PITCH_SHIFT_MAX_VOICES; i++) {
+			if (shimmerGains[i] > 0.0f) {
+				params.ratios[n] = powf(2.0f, shimmerSemitones[i] / 12.0f);
+				params.gains[n] = shimmerGains[i];
+				n++;
+			}
+		}
+		params.voices = n;
+		shimmerMailbox.write(params);
+	}
+
+	json_t *toJson() override {
+		json_t *rootJ = json_object();
+		json_t *voicesJ = json_array();
+		for (int i = 0; i < FFT_PITCH_SHIFT_MAX_VOICES; i++) {
+			json_t *voiceJ = json_array();
+			json_array_append_new(voiceJ, json_real(shimmerSemitones[i]));
+			json_array_append_new(voiceJ, json_real(shimmerGains[i]));
+			json_array_append_new(voicesJ, voiceJ);
+		}
+		json_object_set_new(rootJ, "shimmerVoices", voicesJ);
+		json_object_set_new(rootJ, "shimmerThreaded", json_boolean(isShimmerThreaded()));
+		return rootJ;
+	}
+
+	void fromJson(json_t *rootJ) override {
+		json_t *voicesJ = json_object_get(rootJ, "shimmerVoices");
+		if (voicesJ) {
+			for (int i = 0; i < FFT_PITCH_SHIFT_MAX_VOICES; i++) {
+				json_t *voiceJ = json_array_get(voicesJ, i);
+				if (voiceJ) {
+					json_t *semitonesJ = json_array_get(voiceJ, 0);
+					json_t *gainJ = json_array_get(voiceJ, 1);
+					if (semitonesJ)
+						shimmerSemitones[i] = json_number_value(semitonesJ);
+					if (gainJ)
+						shimmerGains[i] = json_number_value(gainJ);
+				}
+			}
+		}
+		updateShimmer();
+		json_t *shimmerThreadedJ = json_object_get(rootJ, "shimmerThreaded");
+		if (shimmerThreadedJ)
+			setShimmerWorker(json_is_true(shimmerThreadedJ));
+	}
+
+	void updateShimmerWorker();
+	void processBlock();
 	void step() override;
+	void onSampleRateChange() override;
 };
 
-void DFUZE::step() {
-	float outL = 0.0f, outR = 0.0f;
-	float wOutL = 0.0f, wOutR = 0.0f;
-  float inL = 0.0f, inR = 0.0f;
-
-	// if (sr != engineGetSampleRate()) {
-	// 	revprocessor.setsamplerate(engineGetSampleRate());
-	// 	in_L_Buffer.clear();
-	// 	in_R_Buffer.clear();
-	// 	pin_L_Buffer.clear();
-	// 	pin_R_Buffer.clear();
-	// 	sr = engineGetSampleRate();
-	// }
+// The engine is not stepping the module here, the reverb can reallocate its
+// delay lines for the new rate
+void DFUZE::onSampleRateChange() {
+	revprocessor.setsamplerate(engineGetSampleRate());
+	pitchShifterL.reset();
+	pitchShifterR.reset();
+	staggerShifters();
+	if (shimmerWorker)
+		shimmerWorker->resets++;
+	for (int i = 0; i < DFUZE_BLOCK; i++) {
+		shimmerL[i] = 0.0f;
+		shimmerR[i] = 0.0f;
+	}
+}
+
+// Audio thread side of setShimmerWorker(), and the voices from the UI
+void DFUZE::updateShimmerWorker() {
+	if (shimmerMailbox.read(shimmer))
+		shimmerPending = true;
+	if (spareWorker.load()) {
+		DFUZEShimmerWorker *worker = spareWorker.exchange(NULL);
+		if (worker) {
+			if (shimmerWorker)
+				shimmerWorker->retire();
+			shimmerWorker = worker;
+			shimmerPending = true;
+		}
+	}
+	if (shimmerWorker && !shimmerThreaded.load()) {
+		shimmerWorker->retire();
+		shimmerWorker = NULL;
+	}
+	// Tried again on the next block if the worker is that far behind
+	if (shimmerWorker && shimmerPending)
+		shimmerPending = !shimmerWorker->params.push(shimmer);
+}
+
+void DFUZE::processBlock() {
+	float fbL[DFUZE_BLOCK], fbR[DFUZE_BLOCK];
+	float wetL[DFUZE_BLOCK], wetR[DFUZE_BLOCK];
 
 	revprocessor.setdamp(clamp(params[DAMP_PARAM].value+inputs[DAMP_INPUT].value,0.0f,1.0f));
 	revprocessor.setroomsize(clamp(params[SIZE_PARAM].value+inputs[SIZE_INPUT].value,0.0f,1.0f));
 	revprocessor.setwet(clamp(params[WET_PARAM].value,0.0f,1.0f));
-	revprocessor.setdry(clamp(params[DRY_PARAM].value,0.0f,1.0f));
 	revprocessor.setwidth(clamp(params[WIDTH_PARAM].value+inputs[WIDTH_INPUT].value,0.0f,1.0f));
 
-	if (freezeTrigger.process(params[FREEZE_PARAM].value + inputs[FREEZE_INPUT].value )) freeze = !freeze;
-
 	revprocessor.setmode(freeze?1.0:0.0);
 
-	inL = inputs[IN_L_INPUT].value;
-	inR = inputs[IN_R_INPUT].value;
+	float shimmL = params[SHIMM_PARAM].value * 5;
+	float shimmR = clamp(params[SHIMM_PARAM].value+inputs[SHIMM_INPUT].value,0.0f,0.08f) * 5;
+	for (int i = 0; i < DFUZE_BLOCK; i++) {
+		fbL[i] = shimmL * shimmerL[i];
+		fbR[i] = shimmR * shimmerR[i];
+	}
+
+	revprocessor.process(blockInL, blockInR, fbL, fbR, blockOutL, blockOutR, wetL, wetR, DFUZE_BLOCK);
 
-	if (pin_L_Buffer.size()>0) {
-		revprocessor.process(inL, inR, params[SHIMM_PARAM].value * (*pin_L_Buffer.startData()) * 5, clamp(params[SHIMM_PARAM].value+inputs[SHIMM_INPUT].value,0.0f,0.08f) * (*pin_R_Buffer.startData()) * 5, outL, outR, wOutL, wOutR);
-		pin_L_Buffer.startIncr(1);
-		pin_R_Buffer.startIncr(1);
+	for (int i = 0; i < DFUZE_BLOCK; i++) {
+		wetL[i] /= 10;
+		wetR[i] /= 10;
+	}
+	updateShimmerWorker();
+	if (shimmerWorker) {
+		for (int i = 0; i < DFUZE_BLOCK; i++) {
+			shimmerWorker->process(wetL[i], wetR[i], shimmerL[i], shimmerR[i]);
+		}
 	}
 	else {
-		revprocessor.process(inL, inR, 0.0f, 0.0f, outL, outR, wOutL, wOutR);
+		pitchShifterL.process(shimmer.ratios, shimmer.gains, shimmer.voices, DFUZE_BLOCK, wetL, shimmerL);
+		pitchShifterR.process(shimmer.ratios, shimmer.gains, shimmer.voices, DFUZE_BLOCK, wetR, shimmerR);
 	}
+}
 
-	in_L_Buffer.push(wOutL/10);
-	in_R_Buffer.push(wOutR/10);
+void DFUZE::step() {
+	if (freezeTrigger.process(params[FREEZE_PARAM].value + inputs[FREEZE_INPUT].value )) freeze = !freeze;
 
-	if (in_L_Buffer.full())  {
-		smbPitchShift(2.0f, in_L_Buffer.size(), 2048, 4, engineGetSampleRate(), in_L_Buffer.startData(), pin_L_Buffer.endData());
-		smbPitchShift(2.0f, in_R_Buffer.size(), 2048, 4, engineGetSampleRate(), in_R_Buffer.startData(), pin_R_Buffer.endData());
-		pin_L_Buffer.endIncr(in_L_Buffer.size());
-		pin_R_Buffer.endIncr(in_L_Buffer.size());
-		in_L_Buffer.clear();
-		in_R_Buffer.clear();
+	blockInL[blockPos] = inputs[IN_L_INPUT].value;
+	blockInR[blockPos] = inputs[IN_R_INPUT].value;
+	// Same gain as revmodel's dry mix
+	float dry = clamp(params[DRY_PARAM].value,0.0f,1.0f) * scaledry;
+	outputs[OUT_L_OUTPUT].value = blockOutL[blockPos] + inputs[IN_L_INPUT].value * dry;
+	outputs[OUT_R_OUTPUT].value = blockOutR[blockPos] + inputs[IN_R_INPUT].value * dry;
+	if (++blockPos >= DFUZE_BLOCK) {
+		processBlock();
+		blockPos = 0;
 	}
-
-	outputs[OUT_L_OUTPUT].value = outL;
-	outputs[OUT_R_OUTPUT].value = outR;
 }
 
 
 
 struct DFUZEWidget : ModuleWidget {
+	Menu *createContextMenu() override;
+
 	DFUZEWidget(DFUZE *module) : ModuleWidget(module) {
 		setPanel(SVG::load(assetPlugin(plugin, "res/DFUZE.svg")));
 
@@ -135,4 +426,106 @@ struct DFUZEWidget : ModuleWidget {
 	}
 };
 
+struct DFUZEShimmerPresetItem : MenuItem {
+	DFUZE *dfuzeModule;
+	float semitones[FFT_PITCH_SHIFT_MAX_VOICES];
+	float gains[FFT_PITCH_SHIFT_MAX_VOICES];
+	void onAction(EventAction &e) override {
+		for (int i = 0; i < FFT_PITCH_SHIFT_MAX_VOICES; i++) {
+			dfuzeModule->shimmerSemitones[i] = semitones[i];
+			dfuzeModule->shimmerGains[i] = gains[i];
+		}
+		dfuzeModule->updateShimmer();
+	}
+	void step() override {
+		bool selected = true;
+		for (int i = 0; i < FFT_PITCH_SHIFT_MAX_VOICES; i++) {
+			selected &= (dfuzeModule->shimmerSemitones[i] == semitones[i]) && (dfuzeModule->shimmerGains[i] == gains[i]);
+		}
+		rightText = selected ? "✔" : "";
+		MenuItem::step();
+	}
+};
+
+struct DFUZEShimmerThreadItem : MenuItem {
+	DFUZE *dfuzeModule;
+	void onAction(EventAction &e) override {
+		dfuzeModule->setShimmerWorker(!dfuzeModule->isShimmerThreaded());
+	}
+	void step() override {
+		rightText = dfuzeModule->isShimmerThreaded() ? "✔" : "";
+		MenuItem::step();
+	}
+};
+
+struct DFUZEShimmerField : TextField {
+	DFUZE *dfuzeModule;
+	int voice;
+	bool gain;
+	void onTextChange() override {
+		float value = atof(text.c_str());
+		if (gain)
+			dfuzeModule->shimmerGains[voice] = clamp(value, 0.0f, 2.0f);
+		else
+			dfuzeModule->shimmerSemitones[voice] = clamp(value, -24.0f, 24.0f);
+		dfuzeModule->updateShimmer();
+	}
+};
+
+Menu *DFUZEWidget::createContextMenu() {
+	Menu *menu = ModuleWidget::createContextMenu();
+
+	DFUZE *dfuzeModule = dynamic_cast<DFUZE*>(module);
+	assert(dfuzeModule);
+
+	MenuLabel *spacerLabel = new MenuLabel();
+	menu->addChild(spacerLabel);
+
+	MenuLabel *shimmerLabel = new MenuLabel();
+	shimmerLabel->text = "Shimmer";
+	menu->addChild(shimmerLabel);
+
+	static const char *presetNames[3] = {"Octave", "Octave + fifth", "Octave, fifth, octave down"};
+	static const float presetGains[3][FFT_PITCH_SHIFT_MAX_VOICES] = {{1.0f, 0.0f, 0.0f}, {1.0f, 0.7f, 0.0f}, {1.0f, 0.7f, 0.5f}};
+	for (int i = 0; i < 3; i++) {
+		DFUZEShimmerPresetItem *presetItem = new DFUZEShimmerPresetItem();
+		presetItem->text = presetNames[i];
+		presetItem->dfuzeModule = dfuzeModule;
+		for (int j = 0; j < FFT_PITCH_SHIFT_MAX_VOICES; j++) {
+			presetItem->semitones[j] = (j == 0) ? 12.0f : ((j == 1) ? 7.0f : -12.0f);
+			presetItem->gains[j] = presetGains[i][j];
+		}
+		menu->addChild(presetItem);
+	}
+
+	for (int i = 0; i < FFT_PITCH_SHIFT_MAX_VOICES; i++) {
+		MenuLabel *voiceLabel = new MenuLabel();
+		voiceLabel->text = stringf("Voice %d semitones, gain", i + 1);
+		menu->addChild(voiceLabel);
+
+		DFUZEShimmerField *semitonesField = new DFUZEShimmerField();
+		semitonesField->dfuzeModule = dfuzeModule;
+		semitonesField->voice = i;
+		semitonesField->gain = false;
+		semitonesField->box.size = Vec(120.0f, 20.0f);
+		semitonesField->text = stringf("%g", dfuzeModule->shimmerSemitones[i]);
+		menu->addChild(semitonesField);
+
+		DFUZEShimmerField *gainField = new DFUZEShimmerField();
+		gainField->dfuzeModule = dfuzeModule;
+		gainField->voice = i;
+		gainField->gain = true;
+		gainField->box.size = Vec(120.0f, 20.0f);
+		gainField->text = stringf("%g", dfuzeModule->shimmerGains[i]);
+		menu->addChild(gainField);
+	}
+
+	DFUZEShimmerThreadItem *threadItem = new DFUZEShimmerThreadItem();
+	threadItem->text = "Shimmer on worker thread (+1024 samples)";
+	threadItem->dfuzeModule = dfuzeModule;
+	menu->addChild(threadItem);
+
+	return menu;
+}
+
 Model *modelDFUZE = Model::create<DFUZE, DFUZEWidget>("Bidoo", "dFUZE", "dFUZE reverberator", REVERB_TAG);
@@ -2,67 +2,10 @@
 
 #include "Bidoo.hpp"
 #include "BidooComponents.hpp"
-#include "dsp/decimator.hpp"
+#include "dep/filters/ladder.hpp"
 
 using namespace std;
 
-#define pi 3.14159265359
-
-struct FilterStage
-{
-	float mem = 0.0;
-
-	float Filter(float sample, float freq, float smpRate, float gain, int mode)
-	{
-		float g = tan(pi*freq/smpRate);
-		float G = g/(1.0 + g);
-		float out;
-		if (mode == 0) {
-			out = (sample - mem) * G + mem;
-		} else {
-			out = (tanh(sample*gain)/tanh(gain) - mem) * G + mem;
-		}
-		mem = out + (sample - mem) * G	;
-		return out;
-	}
-};
-
-struct LadderFilter
-{
-	FilterStage stage1;
-	FilterStage stage2;
-	FilterStage stage3;
-	FilterStage stage4;
-	float q;
-	float freq;
-	float smpRate;
-	int mode = 0;
-	float gain = 1.0f;
-
-	void setParams(float freq, float q, float smpRate, float gain, int mode) {
-		this->freq = freq;
-		this->q=q;
-		this->smpRate=smpRate;
-		this->mode = mode;
-		this->gain = gain;
-	}
-
-	float calcOutput(float sample)
-	{
-		float g = tan(pi*freq/smpRate);
-		float G = g/(1.0f + g);
-		G = G*G*G*G;
-		float S1 = stage1.mem/(1.0f + g);
-		float S2 = stage2.mem/(1.0f + g);
-		float S3 = stage3.mem/(1.0f + g);
-		float S4 = stage4.mem/(1.0f + g);
-		float S = G*G*G*S1 + G*G*S2 + G*S3 + S4;
-		return stage4.Filter(stage3.Filter(stage2.Filter(stage1.Filter((sample - q*S)/(1.0f + q*G),
-		freq,smpRate,gain,mode),freq,smpRate,gain,mode),freq,smpRate,gain,mode),freq,smpRate,gain,mode);
-	}
-
-};
-
 struct LIMBO : Module {
 	enum ParamIds {
 		CUTOFF_PARAM,
@@ -89,11 +32,25 @@ struct LIMBO : Module {
 		LEARN_LIGHT,
 		NUM_LIGHTS
 	};
-	LadderFilter lFilter,rFilter;
+	StereoLadder ladder;
+	// Oversampling factor of the saturating mode, set from the context menu
+	int oversampling = 1;
 
 	LIMBO() : Module(NUM_PARAMS, NUM_INPUTS, NUM_OUTPUTS, NUM_LIGHTS) {
 	}
 
+	json_t *toJson() override {
+		json_t *rootJ = json_object();
+		json_object_set_new(rootJ, "oversampling", json_integer(oversampling));
+		return rootJ;
+	}
+
+	void fromJson(json_t *rootJ) override {
+		json_t *oversamplingJ = json_object_get(rootJ, "oversampling");
+		if (oversamplingJ)
+			oversampling = json_integer_value(oversamplingJ);
+	}
+
 	void step() override;
 
 };
@@ -103,18 +60,17 @@ void LIMBO::step() {
 	float q = 3.5f * clamp(params[Q_PARAM].value + inputs[Q_INPUT].value / 5.0f, 0.0f, 1.0f);
 	float g = pow(2.0f,rescale(clamp(params[MUG_PARAM].value + inputs[MUG_INPUT].value / 5.0f,0.0f,1.0f),0.0f,1.0f,0.0f,3.0f));
 	int mode = (int)params[MODE_PARAM].value;
-	lFilter.setParams(cfreq,q,engineGetSampleRate(),g/3,mode);
-	rFilter.setParams(cfreq,q,engineGetSampleRate(),g/3,mode);
 	float inL = inputs[IN_L].value/5.0f; //normalise to -1/+1 we consider VCV Rack standard is #+5/-5V on VCO1
 	float inR = inputs[IN_R].value/5.0f;
-	inL = lFilter.calcOutput(inL)*5.0f*(mode == 0 ? g : 1);
-	inR = rFilter.calcOutput(inR)*5.0f*(mode == 0 ? g : 1);
-	outputs[OUT_L].value = inL;
-	outputs[OUT_R].value = inR;
+	ladder.process(cfreq,q,g,mode,oversampling,engineGetSampleRate(),inL,inR);
+	outputs[OUT_L].value = inL*5.0f;
+	outputs[OUT_R].value = inR*5.0f;
 }
 
 
 struct LIMBOWidget : ModuleWidget {
+	Menu *createContextMenu() override;
+
 	LIMBOWidget(LIMBO *module) : ModuleWidget(module) {
 		setPanel(SVG::load(assetPlugin(plugin, "res/LIMBO.svg")));
 
@@ -140,4 +96,41 @@ struct LIMBOWidget : ModuleWidget {
 	}
 };
 
+struct LIMBOOversamplingItem : MenuItem {
+	LIMBO *limboModule;
+	int factor;
+	void onAction(EventAction &e) override {
+		limboModule->oversampling = factor;
+	}
+	void step() override {
+		rightText = (limboModule->oversampling == factor) ? "✔" : "";
+		MenuItem::step();
+	}
+};
+
+Menu *LIMBOWidget::createContextMenu() {
+	Menu *menu = ModuleWidget::createContextMenu();
+
+	LIMBO *limboModule = dynamic_cast<LIMBO*>(module);
+	assert(limboModule);
+
+	MenuLabel *spacerLabel = new MenuLabel();
+	menu->addChild(spacerLabel);
+
+	MenuLabel *oversamplingLabel = new MenuLabel();
+	oversamplingLabel->text = "Saturation oversampling";
+	menu->addChild(oversamplingLabel);
+
+	static const char *factorNames[4] = {"Off", "2x", "4x", "8x"};
+	for (int i = 0; i < 4; i++) {
+		LIMBOOversamplingItem *oversamplingItem = new LIMBOOversamplingItem();
+		oversamplingItem->text = factorNames[i];
+		oversamplingItem->limboModule = limboModule;
+		oversamplingItem->factor = 1 << i;
+		menu->addChild(oversamplingItem);
+	}
+
+	return menu;
+}
+
 Model *modelLIMBO = Model::create<LIMBO, LIMBOWidget>("Bidoo", "lIMbO", "lIMbO filter", FILTER_TAG);
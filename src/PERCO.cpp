@@ -2,39 +2,10 @@
 
 #include "Bidoo.hpp"
 #include "BidooComponents.hpp"
-#include "dsp/decimator.hpp"
+#include "dep/filters/svf.hpp"
 
 using namespace std;
 
-#define pi 3.14159265359
-
-
-struct MultiFilter
-{
-	float q;
-	float freq;
-	float smpRate;
-	float hp = 0.0f,bp = 0.0f,lp = 0.0f,mem1 = 0.0f,mem2 = 0.0f;
-
-	void setParams(float freq, float q, float smpRate) {
-		this->freq = freq;
-		this->q=q;
-		this->smpRate=smpRate;
-	}
-
-	void calcOutput(float sample)
-	{
-		float g = tan(pi*freq/smpRate);
-		float R = 1.0f/(2.0f*q);
-		hp = (sample - (2.0f*R + g)*mem1 - mem2)/(1.0f + 2.0f*R*g + g*g);
-		bp = g*hp + mem1;
-		lp = g*bp +  mem2;
-		mem1 = g*hp + bp;
-		mem2 = g*bp + lp;
-	}
-
-};
-
 struct PERCO : Module {
 	enum ParamIds {
 		CUTOFF_PARAM,
@@ -46,19 +17,25 @@ struct PERCO : Module {
 		IN,
 		CUTOFF_INPUT,
 		Q_INPUT,
+		IN_R,
 		NUM_INPUTS
 	};
 	enum OutputIds {
 		OUT_LP,
 		OUT_BP,
 		OUT_HP,
+		OUT_LP_R,
+		OUT_BP_R,
+		OUT_HP_R,
 		NUM_OUTPUTS
 	};
 	enum LightIds {
 		LEARN_LIGHT,
 		NUM_LIGHTS
 	};
+	SVFCoefficients coefs;
 	MultiFilter filter;
+	int controlCounter = 0;
 
 	PERCO() : Module(NUM_PARAMS, NUM_INPUTS, NUM_OUTPUTS, NUM_LIGHTS) {
 	}
@@ -68,15 +45,28 @@ struct PERCO : Module {
 };
 
 void PERCO::step() {
-	float cfreq = pow(2.0f,rescale(clamp(params[CUTOFF_PARAM].value + params[CMOD_PARAM].value * inputs[CUTOFF_INPUT].value / 5.0f,0.0f,1.0f),0.0f,1.0f,4.5f,13.0f));
-	float q = 10.0f * clamp(params[Q_PARAM].value + inputs[Q_INPUT].value / 5.0f, 0.1f, 1.0f);
-	filter.setParams(cfreq,q,engineGetSampleRate());
-	float in = inputs[IN].value/5.0f; //normalise to -1/+1 we consider VCV Rack standard is #+5/-5V on VCO1
+	if (controlCounter-- <= 0) {
+		controlCounter = SVF_CONTROL_RATE - 1;
+		float cfreq = pow(2.0f,rescale(clamp(params[CUTOFF_PARAM].value + params[CMOD_PARAM].value * inputs[CUTOFF_INPUT].value / 5.0f,0.0f,1.0f),0.0f,1.0f,4.5f,13.0f));
+		float q = 10.0f * clamp(params[Q_PARAM].value + inputs[Q_INPUT].value / 5.0f, 0.1f, 1.0f);
+		coefs.setParams(cfreq,q,engineGetSampleRate());
+	}
+	coefs.tick();
+	float inL = inputs[IN].value/5.0f; //normalise to -1/+1 we consider VCV Rack standard is #+5/-5V on VCO1
+	// The right input is normalled to the left one
+	float inR = inputs[IN_R].active ? inputs[IN_R].value/5.0f : inL;
 	//filtering
-	filter.calcOutput(in);
-	outputs[OUT_LP].value = filter.lp * 5.0f;
-	outputs[OUT_HP].value = filter.hp * 5.0f;
-	outputs[OUT_BP].value = filter.bp * 5.0f;
+	filter.calcOutput(_mm_setr_ps(inL, inR, 0.0f, 0.0f), coefs);
+	float lp[4], bp[4], hp[4];
+	_mm_storeu_ps(lp, filter.lp);
+	_mm_storeu_ps(bp, filter.bp);
+	_mm_storeu_ps(hp, filter.hp);
+	outputs[OUT_LP].value = lp[0] * 5.0f;
+	outputs[OUT_HP].value = hp[0] * 5.0f;
+	outputs[OUT_BP].value = bp[0] * 5.0f;
+	outputs[OUT_LP_R].value = lp[1] * 5.0f;
+	outputs[OUT_HP_R].value = hp[1] * 5.0f;
+	outputs[OUT_BP_R].value = bp[1] * 5.0f;
 }
 
 
@@ -100,6 +90,12 @@ struct PERCOWidget : ModuleWidget {
 		addOutput(Port::create<PJ301MPort>(Vec(10, 320), Port::OUTPUT, module, PERCO::OUT_LP));
 		addOutput(Port::create<PJ301MPort>(Vec(48, 320), Port::OUTPUT, module, PERCO::OUT_BP));
 		addOutput(Port::create<PJ301MPort>(Vec(85, 320), Port::OUTPUT, module, PERCO::OUT_HP));
+
+		// Optional right channel, input above and outputs below like the main row
+		addInput(Port::create<TinyPJ301MPort>(Vec(15, 220), Port::INPUT, module, PERCO::IN_R));
+		addOutput(Port::create<TinyPJ301MPort>(Vec(15, 245), Port::OUTPUT, module, PERCO::OUT_LP_R));
+		addOutput(Port::create<TinyPJ301MPort>(Vec(53, 245), Port::OUTPUT, module, PERCO::OUT_BP_R));
+		addOutput(Port::create<TinyPJ301MPort>(Vec(90, 245), Port::OUTPUT, module, PERCO::OUT_HP_R));
 	}
 };
 
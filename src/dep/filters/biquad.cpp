@@ -159,6 +159,14 @@ void Biquad::calcBiquad(void) {
                 b2 = (V - sqrt(2*V) * K + K * K) * norm;
             }
             break;
+        case bq_type_allpass:
+            norm = 1 / (1 + K / Q + K * K);
+            a0 = (1 - K / Q + K * K) * norm;
+            a1 = 2 * (K * K - 1) * norm;
+            a2 = 1;
+            b1 = a1;
+            b2 = a0;
+            break;
     }
 
     return;
@@ -26,7 +26,8 @@ enum {
     bq_type_notch,
     bq_type_peak,
     bq_type_lowshelf,
-    bq_type_highshelf
+    bq_type_highshelf,
+    bq_type_allpass
 };
 
 class Biquad {
@@ -40,6 +41,8 @@ public:
     void setPeakGain(double peakGainDB);
     void setBiquad(int type, double Fc, double Q, double peakGain);
     float process(float in);
+    // a0, a1, a2, b1, b2
+    void getCoefficients(double *coefs) const;
 
 protected:
     void calcBiquad(void);
@@ -57,4 +60,12 @@ inline float Biquad::process(float in) {
     return out;
 }
 
+inline void Biquad::getCoefficients(double *coefs) const {
+    coefs[0] = a0;
+    coefs[1] = a1;
+    coefs[2] = a2;
+    coefs[3] = b1;
+    coefs[4] = b2;
+}
+
 #endif // Biquad_h
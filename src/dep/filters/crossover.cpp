@@ -0,0 +1,68 @@
+#include "crossover.hpp"
+
+// Butterworth sections, two of them make an LR4 filter
+static const double butterworthQ = 0.70710678118654752;
+
+void stereoBiquad::set(const Biquad &bq)
+{
+	double c[5];
+	bq.getCoefficients(c);
+	a0 = _mm_set1_pd(c[0]);
+	a1 = _mm_set1_pd(c[1]);
+	a2 = _mm_set1_pd(c[2]);
+	b1 = _mm_set1_pd(c[3]);
+	b2 = _mm_set1_pd(c[4]);
+}
+
+void stereoBiquad::reset()
+{
+	z1 = _mm_setzero_pd();
+	z2 = _mm_setzero_pd();
+}
+
+// -----------------------------------------------------------------------------------------------------------------
+
+
+crossover3::crossover3()
+{
+	setFrequencies(0.005, 0.05);
+	reset();
+}
+
+void crossover3::setFrequencies(double lowFc, double highFc)
+{
+	Biquad lp(bq_type_lowpass, lowFc, butterworthQ, 0.0);
+	Biquad hp(bq_type_highpass, lowFc, butterworthQ, 0.0);
+	for (int i = 0; i < 2; i++) {
+		lowLp[i].set(lp);
+		lowHp[i].set(hp);
+	}
+	lp.setFc(highFc);
+	hp.setFc(highFc);
+	for (int i = 0; i < 2; i++) {
+		highLp[i].set(lp);
+		highHp[i].set(hp);
+	}
+	/* what an LR4 low and high pair sums to */
+	lowAp.set(Biquad(bq_type_allpass, highFc, butterworthQ, 0.0));
+}
+
+void crossover3::reset()
+{
+	for (int i = 0; i < 2; i++) {
+		lowLp[i].reset();
+		lowHp[i].reset();
+		highLp[i].reset();
+		highHp[i].reset();
+	}
+	lowAp.reset();
+}
+
+void crossover3::process(float inL, float inR, __m128d *out)
+{
+	__m128d in = _mm_setr_pd(inL, inR);
+	__m128d rest = lowHp[1].process(lowHp[0].process(in));
+	out[0] = lowAp.process(lowLp[1].process(lowLp[0].process(in)));
+	out[1] = highLp[1].process(highLp[0].process(rest));
+	out[2] = highHp[1].process(highHp[0].process(rest));
+}
@@ -0,0 +1,44 @@
+#ifndef crossover_h
+#define crossover_h
+
+#include <emmintrin.h>
+#include "biquad.h"
+
+// Biquad on a stereo pair, left and right in the two lanes of an SSE2
+// double vector, with the coefficients of a Biquad. Doubles because the
+// low crossover points leave float sections around -60dB of noise.
+struct stereoBiquad {
+	__m128d a0, a1, a2, b1, b2;
+	__m128d z1, z2;
+
+	void set(const Biquad &bq);
+	void reset();
+
+	__m128d process(__m128d in) {
+		__m128d out = _mm_add_pd(_mm_mul_pd(in, a0), z1);
+		z1 = _mm_sub_pd(_mm_add_pd(_mm_mul_pd(in, a1), z2), _mm_mul_pd(b1, out));
+		z2 = _mm_sub_pd(_mm_mul_pd(in, a2), _mm_mul_pd(b2, out));
+		return out;
+	}
+};
+
+// Three band Linkwitz-Riley crossover on a stereo pair. Each point is a
+// pair of LR4 (two Butterworth sections) low and high passes, the high
+// part of the first point is split again at the second one and the low
+// band goes through the allpass matching the second point, so the bands
+// are in phase and sum to an allpass of the input.
+class crossover3 {
+public:
+	crossover3();
+	// frequencies relative to the sample rate
+	void setFrequencies(double lowFc, double highFc);
+	void reset();
+	// out gets the low, mid and high bands, left and right in the lanes
+	void process(float inL, float inR, __m128d *out);
+
+protected:
+	stereoBiquad lowLp[2], lowHp[2], highLp[2], highHp[2];
+	stereoBiquad lowAp;
+};
+
+#endif // crossover_h
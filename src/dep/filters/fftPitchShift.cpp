@@ -0,0 +1,323 @@
+/****************************************************************************
+*
+* Phase vocoder pitch shifting derived from smbPitchShift.cpp 1.2,
+* http://blogs.zynaptiq.com/bernsee
+*
+* COPYRIGHT 1999-2015 Stephan M. Bernsee <s.bernsee [AT] zynaptiq [DOT] com>
+*
+* 						The Wide Open License (WOL)
+*
+* Permission to use, copy, modify, distribute and sell this software and its
+* documentation for any purpose is hereby granted without fee, provided that
+* the above copyright notice and this license appear in all source copies.
+* THIS SOFTWARE IS PROVIDED "AS IS" WITHOUT EXPRESS OR IMPLIED WARRANTY OF
+* ANY KIND. See http://www.dspguru.com/wol.htm for more information.
+*
+*****************************************************************************/
+
+#include <string.h>
+#include <math.h>
+#include <xmmintrin.h>
+#include <emmintrin.h>
+#include "fftPitchShift.hpp"
+
+#ifndef M_PI
+#define M_PI 3.14159265358979323846
+#endif
+
+static const float TWO_PI = 6.28318530717958647692f;
+
+// -----------------------------------------------------------------------------------------------------------------
+
+
+static inline __m128 fastAtan2(__m128 y, __m128 x)
+{
+	const __m128 signMask = _mm_castsi128_ps(_mm_set1_epi32(0x80000000));
+	__m128 ax = _mm_andnot_ps(signMask, x);
+	__m128 ay = _mm_andnot_ps(signMask, y);
+	__m128 mx = _mm_max_ps(ax, ay);
+	__m128 mn = _mm_min_ps(ax, ay);
+	/* atan on [0, 1] */
+	__m128 a = _mm_div_ps(mn, _mm_max_ps(mx, _mm_set1_ps(1e-30f)));
+	__m128 s = _mm_mul_ps(a, a);
+	__m128 r = _mm_add_ps(_mm_mul_ps(_mm_set1_ps(-0.0464964749f), s), _mm_set1_ps(0.15931422f));
+	r = _mm_sub_ps(_mm_mul_ps(r, s), _mm_set1_ps(0.327622764f));
+	r = _mm_add_ps(_mm_mul_ps(_mm_mul_ps(r, s), a), a);
+	/* back to the full circle */
+	__m128 swap = _mm_cmpgt_ps(ay, ax);
+	r = _mm_or_ps(_mm_and_ps(swap, _mm_sub_ps(_mm_set1_ps(0.5f * M_PI), r)), _mm_andnot_ps(swap, r));
+	__m128 left = _mm_cmplt_ps(x, _mm_setzero_ps());
+	r = _mm_or_ps(_mm_and_ps(left, _mm_sub_ps(_mm_set1_ps(M_PI), r)), _mm_andnot_ps(left, r));
+	return _mm_or_ps(r, _mm_and_ps(y, signMask));
+}
+
+/* sine and cosine of x in [-pi, pi], folded onto [-pi/2, pi/2] where the
+   Taylor polynomials below are within 4e-6 */
+static inline void fastSinCos(__m128 x, __m128 *s, __m128 *c)
+{
+	const __m128 signMask = _mm_castsi128_ps(_mm_set1_epi32(0x80000000));
+	__m128 sign = _mm_and_ps(x, signMask);
+	__m128 ax = _mm_andnot_ps(signMask, x);
+	/* sin(pi - x) = sin(x), cos(pi - x) = -cos(x) */
+	__m128 fold = _mm_cmpgt_ps(ax, _mm_set1_ps(0.5f * M_PI));
+	ax = _mm_or_ps(_mm_and_ps(fold, _mm_sub_ps(_mm_set1_ps(M_PI), ax)), _mm_andnot_ps(fold, ax));
+	__m128 x2 = _mm_mul_ps(ax, ax);
+	__m128 sp = _mm_add_ps(_mm_mul_ps(_mm_set1_ps(2.7557319e-6f), x2), _mm_set1_ps(-1.9841270e-4f));
+	sp = _mm_add_ps(_mm_mul_ps(sp, x2), _mm_set1_ps(8.3333333e-3f));
+	sp = _mm_add_ps(_mm_mul_ps(sp, x2), _mm_set1_ps(-1.6666667e-1f));
+	sp = _mm_add_ps(_mm_mul_ps(_mm_mul_ps(sp, x2), ax), ax);
+	__m128 cp = _mm_add_ps(_mm_mul_ps(_mm_set1_ps(-2.7557319e-7f), x2), _mm_set1_ps(2.4801587e-5f));
+	cp = _mm_add_ps(_mm_mul_ps(cp, x2), _mm_set1_ps(-1.3888889e-3f));
+	cp = _mm_add_ps(_mm_mul_ps(cp, x2), _mm_set1_ps(4.1666667e-2f));
+	cp = _mm_add_ps(_mm_mul_ps(cp, x2), _mm_set1_ps(-0.5f));
+	cp = _mm_add_ps(_mm_mul_ps(cp, x2), _mm_set1_ps(1.f));
+	*s = _mm_xor_ps(sp, sign);
+	*c = _mm_xor_ps(cp, _mm_and_ps(fold, signMask));
+}
+
+/* x - 2pi * round(x / 2pi) */
+static inline __m128 wrapPhase(__m128 x)
+{
+	__m128 turns = _mm_cvtepi32_ps(_mm_cvtps_epi32(_mm_mul_ps(x, _mm_set1_ps(1.0f / TWO_PI))));
+	return _mm_sub_ps(x, _mm_mul_ps(turns, _mm_set1_ps(TWO_PI)));
+}
+
+// -----------------------------------------------------------------------------------------------------------------
+
+
+fftPitchShifter::fftPitchShifter(long fftFrameSize, long osamp)
+{
+	this->fftFrameSize = fftFrameSize;
+	this->osamp = osamp;
+	stepSize = fftFrameSize/osamp;
+	fftFrameSize2 = fftFrameSize/2;
+	numBins = fftFrameSize2+1;
+	paddedBins = (numBins+3) & ~3L;
+
+	forwardCfg = kiss_fft_alloc(fftFrameSize2, 0, NULL, NULL);
+	inverseCfg = kiss_fft_alloc(fftFrameSize2, 1, NULL, NULL);
+
+	window = new float[fftFrameSize];
+	synWindow = new float[fftFrameSize];
+	for (long k = 0; k < fftFrameSize; k++) {
+		window[k] = -.5*cos(2.*M_PI*(double)k/(double)fftFrameSize)+.5;
+		synWindow[k] = 2.*window[k]/(fftFrameSize2*osamp);
+	}
+
+	twiddles = new kiss_fft_cpx[numBins];
+	for (long k = 0; k < numBins; k++) {
+		twiddles[k].r = cos(2.*M_PI*(double)k/(double)fftFrameSize);
+		twiddles[k].i = -sin(2.*M_PI*(double)k/(double)fftFrameSize);
+	}
+
+	binAdvance = new float[paddedBins];
+	for (long k = 0; k < paddedBins; k++) {
+		binAdvance[k] = 2.*M_PI*(double)((k*stepSize) % fftFrameSize)/(double)fftFrameSize;
+	}
+
+	inFIFO = new float[fftFrameSize];
+	outFIFO = new float[stepSize];
+	outputAccum = new float[2*fftFrameSize];
+	packed = new kiss_fft_cpx[fftFrameSize2];
+	spectrum = new kiss_fft_cpx[fftFrameSize2];
+	binReal = new float[paddedBins];
+	binImag = new float[paddedBins];
+	lastPhase = new float[paddedBins];
+	sumPhase = new float[FFT_PITCH_SHIFT_MAX_VOICES*paddedBins];
+	anaMagn = new float[paddedBins];
+	anaFreq = new float[paddedBins];
+	synMagn = new float[paddedBins];
+	synFreq = new float[paddedBins];
+	reset();
+}
+
+fftPitchShifter::~fftPitchShifter()
+{
+	kiss_fft_free(forwardCfg);
+	kiss_fft_free(inverseCfg);
+	delete[] window;
+	delete[] synWindow;
+	delete[] twiddles;
+	delete[] binAdvance;
+	delete[] inFIFO;
+	delete[] outFIFO;
+	delete[] outputAccum;
+	delete[] packed;
+	delete[] spectrum;
+	delete[] binReal;
+	delete[] binImag;
+	delete[] lastPhase;
+	delete[] sumPhase;
+	delete[] anaMagn;
+	delete[] anaFreq;
+	delete[] synMagn;
+	delete[] synFreq;
+}
+
+void fftPitchShifter::reset()
+{
+	memset(inFIFO, 0, fftFrameSize*sizeof(float));
+	memset(outFIFO, 0, stepSize*sizeof(float));
+	memset(outputAccum, 0, 2*fftFrameSize*sizeof(float));
+	memset(binReal, 0, paddedBins*sizeof(float));
+	memset(binImag, 0, paddedBins*sizeof(float));
+	memset(lastPhase, 0, paddedBins*sizeof(float));
+	memset(sumPhase, 0, FFT_PITCH_SHIFT_MAX_VOICES*paddedBins*sizeof(float));
+	memset(anaMagn, 0, paddedBins*sizeof(float));
+	memset(anaFreq, 0, paddedBins*sizeof(float));
+	rover = fftFrameSize-stepSize;
+}
+
+void fftPitchShifter::process(float pitchShift, long numSampsToProcess, const float *indata, float *outdata)
+{
+	float gain = 1.f;
+	process(&pitchShift, &gain, 1, numSampsToProcess, indata, outdata);
+}
+
+void fftPitchShifter::process(const float *pitchShifts, const float *gains, int numVoices, long numSampsToProcess, const float *indata, float *outdata)
+{
+	if (numVoices > FFT_PITCH_SHIFT_MAX_VOICES) numVoices = FFT_PITCH_SHIFT_MAX_VOICES;
+	long inFifoLatency = fftFrameSize-stepSize;
+
+	for (long i = 0; i < numSampsToProcess; i++) {
+		inFIFO[rover] = indata[i];
+		outdata[i] = outFIFO[rover-inFifoLatency];
+		rover++;
+
+		if (rover >= fftFrameSize) {
+			rover = inFifoLatency;
+			processFrame(pitchShifts, gains, numVoices);
+		}
+	}
+}
+
+void fftPitchShifter::processFrame(const float *pitchShifts, const float *gains, int numVoices)
+{
+	/* window and pack even/odd samples as real/imaginary parts */
+	for (long k = 0; k < fftFrameSize2; k++) {
+		packed[k].r = inFIFO[2*k] * window[2*k];
+		packed[k].i = inFIFO[2*k+1] * window[2*k+1];
+	}
+
+	forwardFft();
+	analysis();
+	synthesis(pitchShifts, gains, numVoices);
+	inverseFft();
+
+	/* overlap-add the unpacked frame */
+	for (long k = 0; k < fftFrameSize2; k++) {
+		outputAccum[2*k] += synWindow[2*k] * packed[k].r;
+		outputAccum[2*k+1] += synWindow[2*k+1] * packed[k].i;
+	}
+	memcpy(outFIFO, outputAccum, stepSize*sizeof(float));
+	memmove(outputAccum, outputAccum+stepSize, fftFrameSize*sizeof(float));
+	memmove(inFIFO, inFIFO+stepSize, (fftFrameSize-stepSize)*sizeof(float));
+}
+
+/* spectrum of the packed frame -> bins 0 ... fftFrameSize/2 */
+void fftPitchShifter::forwardFft()
+{
+	kiss_fft(forwardCfg, packed, spectrum);
+
+	long M = fftFrameSize2;
+	for (long k = 0; k <= M; k++) {
+		kiss_fft_cpx z = spectrum[k == M ? 0 : k];
+		kiss_fft_cpx zc = spectrum[k == 0 ? 0 : M-k];
+		/* even part (Z[k] + conj(Z[M-k]))/2, odd part (Z[k] - conj(Z[M-k]))/2i */
+		float er = .5f * (z.r + zc.r);
+		float ei = .5f * (z.i - zc.i);
+		float orr = .5f * (z.i + zc.i);
+		float oi = -.5f * (z.r - zc.r);
+		binReal[k] = er + twiddles[k].r * orr - twiddles[k].i * oi;
+		binImag[k] = ei + twiddles[k].r * oi + twiddles[k].i * orr;
+	}
+}
+
+/* bins 0 ... fftFrameSize/2 -> packed frame, scaled like smbPitchShift's inverse */
+void fftPitchShifter::inverseFft()
+{
+	long M = fftFrameSize2;
+	/* the DC and Nyquist bins of a real signal have no imaginary part */
+	binImag[0] = 0.f;
+	binImag[M] = 0.f;
+	for (long k = 0; k < M; k++) {
+		float yr = binReal[k], yi = binImag[k];
+		float cr = binReal[M-k], ci = -binImag[M-k];
+		float er = .5f * (yr + cr);
+		float ei = .5f * (yi + ci);
+		float dr = .5f * (yr - cr);
+		float di = .5f * (yi - ci);
+		/* odd part is the difference rotated back by the conjugate twiddle */
+		float orr = dr * twiddles[k].r + di * twiddles[k].i;
+		float oi = di * twiddles[k].r - dr * twiddles[k].i;
+		spectrum[k].r = er - oi;
+		spectrum[k].i = ei + orr;
+	}
+
+	kiss_fft(inverseCfg, spectrum, packed);
+}
+
+/* magnitude and true frequency (in bins) of each bin, four at a time */
+void fftPitchShifter::analysis()
+{
+	const __m128 two = _mm_set1_ps(2.f);
+	const __m128 binsPerRadian = _mm_set1_ps((float)osamp / TWO_PI);
+	__m128 bin = _mm_set_ps(3.f, 2.f, 1.f, 0.f);
+	const __m128 four = _mm_set1_ps(4.f);
+
+	for (long k = 0; k < numBins; k += 4) {
+		__m128 re = _mm_loadu_ps(binReal+k);
+		__m128 im = _mm_loadu_ps(binImag+k);
+
+		__m128 magn = _mm_mul_ps(two, _mm_sqrt_ps(_mm_add_ps(_mm_mul_ps(re, re), _mm_mul_ps(im, im))));
+		__m128 phase = fastAtan2(im, re);
+
+		/* phase difference minus the expected one, mapped into +/- Pi */
+		__m128 delta = _mm_sub_ps(_mm_sub_ps(phase, _mm_loadu_ps(lastPhase+k)), _mm_loadu_ps(binAdvance+k));
+		_mm_storeu_ps(lastPhase+k, phase);
+		delta = wrapPhase(delta);
+
+		_mm_storeu_ps(anaMagn+k, magn);
+		_mm_storeu_ps(anaFreq+k, _mm_add_ps(bin, _mm_mul_ps(delta, binsPerRadian)));
+		bin = _mm_add_ps(bin, four);
+	}
+}
+
+void fftPitchShifter::synthesis(const float *pitchShifts, const float *gains, int numVoices)
+{
+	memset(binReal, 0, paddedBins*sizeof(float));
+	memset(binImag, 0, paddedBins*sizeof(float));
+
+	/* a partial at f bins advances by 2pi*f/osamp over one hop */
+	const __m128 expct = _mm_set1_ps(TWO_PI/osamp);
+
+	/* the inverse transform is linear, so the voices simply add up in the bins */
+	for (int v = 0; v < numVoices; v++) {
+		float pitchShift = pitchShifts[v];
+		float *voicePhase = sumPhase + v*paddedBins;
+
+		/* this does the actual pitch shifting */
+		memset(synMagn, 0, paddedBins*sizeof(float));
+		memset(synFreq, 0, paddedBins*sizeof(float));
+		for (long k = 0; k < numBins; k++) {
+			long index = k*pitchShift;
+			if (index <= fftFrameSize2) {
+				synMagn[index] += anaMagn[k];
+				synFreq[index] = anaFreq[k] * pitchShift;
+			}
+		}
+
+		/* accumulate the phases and add the voice to the bins, four at a time */
+		const __m128 gain = _mm_set1_ps(gains[v]);
+		for (long k = 0; k < numBins; k += 4) {
+			__m128 phase = _mm_add_ps(_mm_loadu_ps(voicePhase+k), _mm_mul_ps(_mm_loadu_ps(synFreq+k), expct));
+			phase = wrapPhase(phase);
+			_mm_storeu_ps(voicePhase+k, phase);
+			__m128 magn = _mm_mul_ps(gain, _mm_loadu_ps(synMagn+k));
+			__m128 s, c;
+			fastSinCos(phase, &s, &c);
+			_mm_storeu_ps(binReal+k, _mm_add_ps(_mm_loadu_ps(binReal+k), _mm_mul_ps(magn, c)));
+			_mm_storeu_ps(binImag+k, _mm_add_ps(_mm_loadu_ps(binImag+k), _mm_mul_ps(magn, s)));
+		}
+	}
+}
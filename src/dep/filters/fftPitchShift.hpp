@@ -0,0 +1,64 @@
+#ifndef fftPitchShift_h
+#define fftPitchShift_h
+
+#include "kiss_fft.h"
+
+#define FFT_PITCH_SHIFT_MAX_VOICES 3
+
+// Phase vocoder pitch shifter after Bernsee's smbPitchShift, on a real FFT:
+// the fftFrameSize real samples of a frame go through a fftFrameSize/2
+// complex kiss_fft and are split into the fftFrameSize/2+1 bins afterwards.
+// Windows, split twiddles and expected phase advances are tables computed
+// once, analysis runs four bins at a time with SSE and a polynomial atan2
+// (about 1e-5 rad off), synthesis likewise with a polynomial sincos, and
+// frequencies are kept in bins rather than Hz so the sample rate drops
+// out. fftFrameSize must be a power of 2, at least 8.
+// Up to FFT_PITCH_SHIFT_MAX_VOICES intervals are synthesized from the same
+// analysis and summed before a single inverse transform, so each extra
+// voice only costs its bin mapping and phase accumulation.
+class fftPitchShifter {
+public:
+	fftPitchShifter(long fftFrameSize, long osamp);
+	~fftPitchShifter();
+	fftPitchShifter(const fftPitchShifter&) = delete;
+	fftPitchShifter& operator=(const fftPitchShifter&) = delete;
+	void reset();
+	void process(float pitchShift, long numSampsToProcess, const float *indata, float *outdata);
+	void process(const float *pitchShifts, const float *gains, int numVoices, long numSampsToProcess, const float *indata, float *outdata);
+
+protected:
+	void processFrame(const float *pitchShifts, const float *gains, int numVoices);
+	void forwardFft();
+	void inverseFft();
+	void analysis();
+	void synthesis(const float *pitchShifts, const float *gains, int numVoices);
+
+	long fftFrameSize, osamp, stepSize, fftFrameSize2, numBins, paddedBins;
+	long rover;
+	kiss_fft_cfg forwardCfg, inverseCfg;
+	// Hann window, and the same with the overlap-add gain folded in
+	float *window;
+	float *synWindow;
+	// e^(-2*pi*i*k/fftFrameSize) for the real/complex split
+	kiss_fft_cpx *twiddles;
+	// expected phase advance of each bin over one hop, wrapped to [0, 2pi)
+	float *binAdvance;
+	float *inFIFO;
+	float *outFIFO;
+	float *outputAccum;
+	// a frame packed as fftFrameSize/2 complex samples, and its transform
+	kiss_fft_cpx *packed;
+	kiss_fft_cpx *spectrum;
+	// numBins bins, padded to a multiple of 4 for the SSE kernels
+	float *binReal;
+	float *binImag;
+	float *lastPhase;
+	// synthesis phases, paddedBins per voice
+	float *sumPhase;
+	float *anaMagn;
+	float *anaFreq;
+	float *synMagn;
+	float *synFreq;
+};
+
+#endif // fftPitchShift_h
@@ -0,0 +1,151 @@
+#include <string.h>
+#include <xmmintrin.h>
+#include "halfBand.hpp"
+
+// Kaiser windowed (beta 10) half-band designs, the nonzero taps on one side
+// of the 0.5 center, nearest first
+
+static const float longSideTaps[16] = {
+	3.168385981e-01f,
+	-1.017623041e-01f,
+	5.666271368e-02f,
+	-3.614473496e-02f,
+	2.412715875e-02f,
+	-1.624998459e-02f,
+	1.082781261e-02f,
+	-7.044008377e-03f,
+	4.425659408e-03f,
+	-2.657038433e-03f,
+	1.505939949e-03f,
+	-7.931634345e-04f,
+	3.793724179e-04f,
+	-1.585919390e-04f,
+	5.366828945e-05f,
+	-1.181867503e-05f
+};
+
+static const float shortSideTaps[8] = {
+	3.124613989e-01f,
+	-8.968105296e-02f,
+	3.961452300e-02f,
+	-1.753142587e-02f,
+	6.902243377e-03f,
+	-2.208622297e-03f,
+	5.006060757e-04f,
+	-5.467208545e-05f
+};
+
+// -----------------------------------------------------------------------------------------------------------------
+
+
+static inline float dot(const float *a, const float *b, int n)
+{
+	__m128 s = _mm_setzero_ps();
+	for (int i = 0; i < n; i += 4) {
+		s = _mm_add_ps(s, _mm_mul_ps(_mm_loadu_ps(a + i), _mm_loadu_ps(b + i)));
+	}
+	s = _mm_add_ps(s, _mm_movehl_ps(s, s));
+	s = _mm_add_ss(s, _mm_shuffle_ps(s, s, 1));
+	return _mm_cvtss_f32(s);
+}
+
+void halfBandFilter::init(const float *sideTaps, int numTaps)
+{
+	this->numTaps = numTaps;
+	int k = numTaps / 2;
+	/* the branch is symmetric, farthest taps at both ends */
+	for (int i = 0; i < k; i++) {
+		kernel[i] = sideTaps[k - 1 - i];
+		kernel[numTaps - 1 - i] = sideTaps[k - 1 - i];
+	}
+	reset();
+}
+
+void halfBandFilter::reset()
+{
+	memset(upHistory, 0, sizeof(upHistory));
+	memset(oddHistory, 0, sizeof(oddHistory));
+	memset(evenHistory, 0, sizeof(evenHistory));
+	upPos = 0;
+	downPos = 0;
+}
+
+void halfBandFilter::upsample(float in, float *out)
+{
+	upPos = (upPos + 1 < numTaps) ? upPos + 1 : 0;
+	upHistory[upPos] = in;
+	upHistory[upPos + numTaps] = in;
+	const float *h = upHistory + upPos + 1;
+	/* zero stuffing halves the gain, the interpolated samples make up for it
+	   and the others are the input half the branch length late */
+	out[0] = 2.0f * dot(h, kernel, numTaps);
+	out[1] = h[numTaps / 2];
+}
+
+float halfBandFilter::downsample(const float *in)
+{
+	downPos = (downPos + 1 < numTaps) ? downPos + 1 : 0;
+	evenHistory[downPos] = in[0];
+	evenHistory[downPos + numTaps] = in[0];
+	oddHistory[downPos] = in[1];
+	oddHistory[downPos + numTaps] = in[1];
+	/* the center tap lands on the samples upsample() passes through */
+	return 0.5f * oddHistory[downPos + numTaps / 2] + dot(evenHistory + downPos + 1, kernel, numTaps);
+}
+
+// -----------------------------------------------------------------------------------------------------------------
+
+
+halfBandOversampler::halfBandOversampler()
+{
+	up[0].init(longSideTaps, 32);
+	down[0].init(longSideTaps, 32);
+	for (int i = 1; i < HALF_BAND_MAX_STAGES; i++) {
+		up[i].init(shortSideTaps, 16);
+		down[i].init(shortSideTaps, 16);
+	}
+}
+
+void halfBandOversampler::setFactor(int factor)
+{
+	int stages = (factor >= 8) ? 3 : (factor >= 4) ? 2 : (factor >= 2) ? 1 : 0;
+	if (stages != numStages) {
+		numStages = stages;
+		this->factor = 1 << stages;
+		reset();
+	}
+}
+
+void halfBandOversampler::reset()
+{
+	for (int i = 0; i < HALF_BAND_MAX_STAGES; i++) {
+		up[i].reset();
+		down[i].reset();
+	}
+}
+
+void halfBandOversampler::upsample(float in, float *out)
+{
+	float buf[1 << (HALF_BAND_MAX_STAGES - 1)];
+	out[0] = in;
+	for (int s = 0, n = 1; s < numStages; s++, n *= 2) {
+		memcpy(buf, out, sizeof(float) * n);
+		for (int i = 0; i < n; i++) {
+			up[s].upsample(buf[i], out + 2 * i);
+		}
+	}
+}
+
+float halfBandOversampler::downsample(const float *in)
+{
+	float buf[1 << HALF_BAND_MAX_STAGES];
+	if (numStages == 0)
+		return in[0];
+	memcpy(buf, in, sizeof(float) * factor);
+	for (int s = numStages - 1, n = factor / 2; s >= 0; s--, n /= 2) {
+		for (int i = 0; i < n; i++) {
+			buf[i] = down[s].downsample(buf + 2 * i);
+		}
+	}
+	return buf[0];
+}
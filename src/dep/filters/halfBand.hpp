@@ -0,0 +1,57 @@
+#ifndef halfBand_h
+#define halfBand_h
+
+#define HALF_BAND_MAX_TAPS 32
+#define HALF_BAND_MAX_STAGES 3
+
+// One polyphase half-band FIR stage, interpolating or decimating by 2.
+// A half-band filter of 4K-1 taps has every other tap at 0 apart from the
+// 0.5 center, so each output pair (interpolating) or output (decimating)
+// costs one symmetric 2K taps dot product, computed with SSE, plus the
+// center tap which is only a delay. numTaps is 2K, a multiple of 4.
+class halfBandFilter {
+public:
+	void init(const float *sideTaps, int numTaps);
+	void reset();
+	// in at the low rate, out gets the 2 samples at the high rate
+	void upsample(float in, float *out);
+	// in holds 2 samples at the high rate
+	float downsample(const float *in);
+
+protected:
+	int numTaps = 0;
+	// the 2K taps of one polyphase branch, in time order
+	float kernel[HALF_BAND_MAX_TAPS];
+	// mirrored histories, the last numTaps samples are at pos+1..pos+numTaps
+	float upHistory[2*HALF_BAND_MAX_TAPS];
+	float oddHistory[2*HALF_BAND_MAX_TAPS];
+	float evenHistory[2*HALF_BAND_MAX_TAPS];
+	int upPos = 0;
+	int downPos = 0;
+};
+
+// 2x, 4x or 8x up and down sampling with a cascade of halfBandFilters.
+// The stage next to the base rate is 63 taps long, the following ones
+// only have to reject images that are already an octave away and use 31.
+// Passband ripple is under 2e-5 up to 0.4 of the base rate, stopband
+// under -99dB.
+class halfBandOversampler {
+public:
+	halfBandOversampler();
+	// 1, 2, 4 or 8, resets the filters when it changes
+	void setFactor(int factor);
+	int getFactor() const { return factor; }
+	void reset();
+	// factor samples out for one in
+	void upsample(float in, float *out);
+	// one sample out for factor in
+	float downsample(const float *in);
+
+protected:
+	int factor = 1;
+	int numStages = 0;
+	halfBandFilter up[HALF_BAND_MAX_STAGES];
+	halfBandFilter down[HALF_BAND_MAX_STAGES];
+};
+
+#endif // halfBand_h
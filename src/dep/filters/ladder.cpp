@@ -0,0 +1,30 @@
+#include "ladder.hpp"
+
+void StereoLadder::process(float cfreq, float q, float g, int mode, int oversampling, float sampleRate, float &l, float &r) {
+	// The linear mode does not alias, only the saturating one is oversampled
+	int factor = (mode == 1) ? oversampling : 1;
+	lOversampler.setFactor(factor);
+	rOversampler.setFactor(factor);
+	factor = lOversampler.getFactor();
+	if (factor > 1) {
+		float bufL[1 << HALF_BAND_MAX_STAGES], bufR[1 << HALF_BAND_MAX_STAGES];
+		float out[4];
+		coefs.setParams(cfreq,q,sampleRate*factor,g/3,mode);
+		lOversampler.upsample(l, bufL);
+		rOversampler.upsample(r, bufR);
+		for (int i = 0; i < factor; i++) {
+			_mm_storeu_ps(out, filter.calcOutput(_mm_setr_ps(bufL[i], bufR[i], 0.0f, 0.0f), coefs));
+			bufL[i] = out[0];
+			bufR[i] = out[1];
+		}
+		l = lOversampler.downsample(bufL);
+		r = rOversampler.downsample(bufR);
+	}
+	else {
+		float out[4];
+		coefs.setParams(cfreq,q,sampleRate,g/3,mode);
+		_mm_storeu_ps(out, filter.calcOutput(_mm_setr_ps(l, r, 0.0f, 0.0f), coefs));
+		l = out[0]*(mode == 0 ? g : 1);
+		r = out[1]*(mode == 0 ? g : 1);
+	}
+}
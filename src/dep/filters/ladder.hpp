@@ -0,0 +1,126 @@
+#ifndef ladder_h
+#define ladder_h
+
+#include <math.h>
+#include <xmmintrin.h>
+#include "halfBand.hpp"
+
+// LIMBO's ladder filter, based on Will Pirkle's courses & Vadim
+// Zavalishin's book
+
+#define LADDER_PI 3.14159265359
+
+// Pade approximant of tanh on four lanes, within 1e-4 of it. Past +-4.97
+// it would overshoot 1, the input is clamped there.
+inline __m128 fastTanh(__m128 x) {
+	x = _mm_max_ps(_mm_min_ps(x, _mm_set1_ps(4.97f)), _mm_set1_ps(-4.97f));
+	__m128 x2 = _mm_mul_ps(x, x);
+	__m128 num = _mm_add_ps(_mm_set1_ps(378.0f), x2);
+	num = _mm_add_ps(_mm_set1_ps(17325.0f), _mm_mul_ps(x2, num));
+	num = _mm_mul_ps(x, _mm_add_ps(_mm_set1_ps(135135.0f), _mm_mul_ps(x2, num)));
+	__m128 den = _mm_add_ps(_mm_set1_ps(3150.0f), _mm_mul_ps(_mm_set1_ps(28.0f), x2));
+	den = _mm_add_ps(_mm_set1_ps(62370.0f), _mm_mul_ps(x2, den));
+	den = _mm_add_ps(_mm_set1_ps(135135.0f), _mm_mul_ps(x2, den));
+	return _mm_div_ps(num, den);
+}
+
+// Everything the ladder derives from its parameters, recomputed only when
+// one of them changes and shared by all stages of all lanes
+struct LadderCoefficients
+{
+	float freq = -1.0f;
+	float q = 0.0f;
+	float smpRate = 0.0f;
+	float gain = 1.0f;
+	int mode = 0;
+	// one pole gain and 1/(1+g)
+	__m128 G = _mm_setzero_ps();
+	__m128 invG1 = _mm_set1_ps(1.0f);
+	// powers of G^4 used by the feedback estimate, q and 1/(1+q*G^4)
+	__m128 G4 = _mm_setzero_ps(), G8 = _mm_setzero_ps(), G12 = _mm_setzero_ps();
+	__m128 Q = _mm_setzero_ps();
+	__m128 invQG4 = _mm_set1_ps(1.0f);
+	__m128 Gain = _mm_set1_ps(1.0f);
+	__m128 invTanhGain = _mm_set1_ps(1.0f);
+	float G4s = 0.0f;
+
+	void setParams(float freq, float q, float smpRate, float gain, int mode) {
+		if (freq != this->freq || smpRate != this->smpRate) {
+			this->freq = freq;
+			this->smpRate = smpRate;
+			float g = tan(LADDER_PI*freq/smpRate);
+			float Gs = g/(1.0f + g);
+			G4s = Gs*Gs*Gs*Gs;
+			G = _mm_set1_ps(Gs);
+			invG1 = _mm_set1_ps(1.0f/(1.0f + g));
+			G4 = _mm_set1_ps(G4s);
+			G8 = _mm_set1_ps(G4s*G4s);
+			G12 = _mm_set1_ps(G4s*G4s*G4s);
+			this->q = -1.0f;
+		}
+		if (q != this->q) {
+			this->q = q;
+			Q = _mm_set1_ps(q);
+			invQG4 = _mm_set1_ps(1.0f/(1.0f + q*G4s));
+		}
+		if (gain != this->gain) {
+			this->gain = gain;
+			Gain = _mm_set1_ps(gain);
+			invTanhGain = _mm_set1_ps(1.0f/tanh(gain));
+		}
+		this->mode = mode;
+	}
+};
+
+// Four ladders, one per lane: stereo uses lanes 0 and 1 and costs the same
+// as mono, the other two are free for more channels. The state is one
+// vector per stage, each holding that stage's memory for all four lanes.
+struct LadderFilter
+{
+	__m128 mem[4];
+
+	LadderFilter() {
+		for (int i = 0; i < 4; i++) {
+			mem[i] = _mm_setzero_ps();
+		}
+	}
+
+	__m128 stage(int i, __m128 sample, const LadderCoefficients &c)
+	{
+		__m128 out;
+		if (c.mode == 0) {
+			out = _mm_add_ps(_mm_mul_ps(_mm_sub_ps(sample, mem[i]), c.G), mem[i]);
+		} else {
+			__m128 sat = _mm_mul_ps(fastTanh(_mm_mul_ps(sample, c.Gain)), c.invTanhGain);
+			out = _mm_add_ps(_mm_mul_ps(_mm_sub_ps(sat, mem[i]), c.G), mem[i]);
+		}
+		mem[i] = _mm_add_ps(out, _mm_mul_ps(_mm_sub_ps(sample, mem[i]), c.G));
+		return out;
+	}
+
+	__m128 calcOutput(__m128 sample, const LadderCoefficients &c)
+	{
+		__m128 S1 = _mm_mul_ps(mem[0], c.invG1);
+		__m128 S2 = _mm_mul_ps(mem[1], c.invG1);
+		__m128 S3 = _mm_mul_ps(mem[2], c.invG1);
+		__m128 S4 = _mm_mul_ps(mem[3], c.invG1);
+		__m128 S = _mm_add_ps(_mm_add_ps(_mm_add_ps(_mm_mul_ps(c.G12, S1), _mm_mul_ps(c.G8, S2)), _mm_mul_ps(c.G4, S3)), S4);
+		__m128 x = _mm_mul_ps(_mm_sub_ps(sample, _mm_mul_ps(c.Q, S)), c.invQG4);
+		return stage(3, stage(2, stage(1, stage(0, x, c), c), c), c);
+	}
+
+};
+
+// LIMBO's stereo path: the ladder on lanes 0 and 1, its saturating mode
+// run oversampling times faster between half-band cascades. Takes and
+// returns signals normalised to -1/+1.
+struct StereoLadder
+{
+	LadderCoefficients coefs;
+	LadderFilter filter;
+	halfBandOversampler lOversampler,rOversampler;
+
+	void process(float cfreq, float q, float g, int mode, int oversampling, float sampleRate, float &l, float &r);
+};
+
+#endif // ladder_h
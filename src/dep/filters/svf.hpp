@@ -0,0 +1,94 @@
+#ifndef svf_h
+#define svf_h
+
+#include <math.h>
+#include <xmmintrin.h>
+
+// PERCO's state variable filter, based on Will Pirkle's courses & Vadim
+// Zavalishin's book
+
+#define SVF_PI 3.14159265359
+
+#define SVF_CONTROL_RATE 16
+
+// State variable filter coefficients. The cutoff and Q are read every
+// SVF_CONTROL_RATE samples, tan() only runs when they changed, and the
+// coefficients then move linearly to the new values over the next
+// SVF_CONTROL_RATE samples so sweeps do not step.
+struct SVFCoefficients
+{
+	float freq = -1.0f;
+	float q = -1.0f;
+	float smpRate = 0.0f;
+	// g, 2R+g and 1/(1+2Rg+g^2) in use, their targets and increments
+	float g = 0.0f, k = 0.0f, d = 1.0f;
+	float gTarget = 0.0f, kTarget = 0.0f, dTarget = 1.0f;
+	float gInc = 0.0f, kInc = 0.0f, dInc = 0.0f;
+	int steps = 0;
+
+	void setParams(float freq, float q, float smpRate) {
+		if (freq == this->freq && q == this->q && smpRate == this->smpRate)
+			return;
+		bool first = this->freq < 0.0f;
+		this->freq = freq;
+		this->q = q;
+		this->smpRate = smpRate;
+		float R = 1.0f/(2.0f*q);
+		gTarget = tan(SVF_PI*freq/smpRate);
+		kTarget = 2.0f*R + gTarget;
+		dTarget = 1.0f/(1.0f + 2.0f*R*gTarget + gTarget*gTarget);
+		if (first) {
+			g = gTarget;
+			k = kTarget;
+			d = dTarget;
+			steps = 0;
+		}
+		else {
+			gInc = (gTarget - g)/SVF_CONTROL_RATE;
+			kInc = (kTarget - k)/SVF_CONTROL_RATE;
+			dInc = (dTarget - d)/SVF_CONTROL_RATE;
+			steps = SVF_CONTROL_RATE;
+		}
+	}
+
+	// Once per sample
+	void tick() {
+		if (steps > 0) {
+			if (--steps == 0) {
+				g = gTarget;
+				k = kTarget;
+				d = dTarget;
+			}
+			else {
+				g += gInc;
+				k += kInc;
+				d += dInc;
+			}
+		}
+	}
+};
+
+// Four SVFs sharing the coefficients, one per lane. PERCO uses lane 0 for
+// the left channel and lane 1 for the right one, which costs as much as
+// the left one alone.
+struct MultiFilter
+{
+	__m128 hp, bp, lp, mem1, mem2;
+
+	MultiFilter() {
+		hp = bp = lp = mem1 = mem2 = _mm_setzero_ps();
+	}
+
+	void calcOutput(__m128 sample, const SVFCoefficients &c)
+	{
+		__m128 g = _mm_set1_ps(c.g);
+		hp = _mm_mul_ps(_mm_sub_ps(_mm_sub_ps(sample, _mm_mul_ps(_mm_set1_ps(c.k), mem1)), mem2), _mm_set1_ps(c.d));
+		bp = _mm_add_ps(_mm_mul_ps(g, hp), mem1);
+		lp = _mm_add_ps(_mm_mul_ps(g, bp), mem2);
+		mem1 = _mm_add_ps(_mm_mul_ps(g, hp), bp);
+		mem2 = _mm_add_ps(_mm_mul_ps(g, bp), lp);
+	}
+
+};
+
+#endif // svf_h
@@ -0,0 +1,83 @@
+#include <string.h>
+#include <xmmintrin.h>
+#include "truePeak.hpp"
+
+// Kaiser windowed (beta 4) sinc interpolating by 4, tap 4k+q is the weight
+// of the input k samples back in branch q
+
+static const float taps[4*TRUE_PEAK_TAPS] = {
+	-3.463498317e-03f,
+	-7.017130165e-03f,
+	-6.769740597e-03f,
+	0.000000000e+00f,
+	1.146880969e-02f,
+	2.043424179e-02f,
+	1.792056345e-02f,
+	0.000000000e+00f,
+	-2.660803715e-02f,
+	-4.525402725e-02f,
+	-3.824577533e-02f,
+	0.000000000e+00f,
+	5.401375123e-02f,
+	9.060146624e-02f,
+	7.611005685e-02f,
+	0.000000000e+00f,
+	-1.092562083e-01f,
+	-1.883567891e-01f,
+	-1.658164211e-01f,
+	0.000000000e+00f,
+	2.913856950e-01f,
+	6.283474494e-01f,
+	8.973806752e-01f,
+	1.000000000e+00f,
+	8.973806752e-01f,
+	6.283474494e-01f,
+	2.913856950e-01f,
+	0.000000000e+00f,
+	-1.658164211e-01f,
+	-1.883567891e-01f,
+	-1.092562083e-01f,
+	0.000000000e+00f,
+	7.611005685e-02f,
+	9.060146624e-02f,
+	5.401375123e-02f,
+	0.000000000e+00f,
+	-3.824577533e-02f,
+	-4.525402725e-02f,
+	-2.660803715e-02f,
+	0.000000000e+00f,
+	1.792056345e-02f,
+	2.043424179e-02f,
+	1.146880969e-02f,
+	0.000000000e+00f,
+	-6.769740597e-03f,
+	-7.017130165e-03f,
+	-3.463498317e-03f,
+	0.000000000e+00f
+};
+
+// -----------------------------------------------------------------------------------------------------------------
+
+
+void truePeakDetector::reset()
+{
+	memset(history, 0, sizeof(history));
+	pos = 0;
+}
+
+float truePeakDetector::process(float in)
+{
+	pos = (pos + 1 < TRUE_PEAK_TAPS) ? pos + 1 : 0;
+	history[pos] = in;
+	history[pos + TRUE_PEAK_TAPS] = in;
+	/* newest sample last */
+	const float *h = history + pos + TRUE_PEAK_TAPS;
+	__m128 s = _mm_setzero_ps();
+	for (int k = 0; k < TRUE_PEAK_TAPS; k++) {
+		s = _mm_add_ps(s, _mm_mul_ps(_mm_loadu_ps(taps + 4 * k), _mm_set1_ps(h[-k])));
+	}
+	s = _mm_andnot_ps(_mm_set1_ps(-0.0f), s);
+	s = _mm_max_ps(s, _mm_movehl_ps(s, s));
+	s = _mm_max_ss(s, _mm_shuffle_ps(s, s, 1));
+	return _mm_cvtss_f32(s);
+}
@@ -0,0 +1,27 @@
+#ifndef truePeak_h
+#define truePeak_h
+
+#define TRUE_PEAK_TAPS 12
+#define TRUE_PEAK_LATENCY 6
+
+// True peak level after BS.1770: the input is interpolated 4x by a 48 taps
+// polyphase FIR and the largest absolute value of the 4 samples is taken.
+// The 4 branches are the lanes of one SSE vector, so a sample costs 12
+// multiply-adds. The kernel is a Kaiser windowed (beta 4) sinc whose
+// center tap is 1, one branch passes the input through and the reading is
+// never under the sample peak. Sines up to 0.42 of the rate read within
+// -0.51/+0.07dB of their peak. The readings are TRUE_PEAK_LATENCY samples
+// late, at most.
+class truePeakDetector {
+public:
+	truePeakDetector() { reset(); }
+	void reset();
+	float process(float in);
+
+protected:
+	// mirrored history, the last TRUE_PEAK_TAPS samples are at pos+1..pos+TRUE_PEAK_TAPS
+	float history[2*TRUE_PEAK_TAPS];
+	int pos = 0;
+};
+
+#endif // truePeak_h
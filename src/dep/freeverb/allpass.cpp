@@ -23,14 +23,6 @@ void allpass::setbuffer(float *buf, int size)
 	bufsize = size;
 }
 
-void allpass::changebuffer(float *buf, int size)
-	{
-		if (buffer) {delete buffer;}
-		buffer = new float[size];
-		bufsize = size;
-		bufidx = 0;
-}
-
 void allpass::mute()
 {
 	for (int i=0; i<bufsize; i++)
@@ -12,7 +12,6 @@ struct allpass
 	allpass();
 	~allpass();
 	void	setbuffer(float *buf, int size);
-	void	changebuffer(float *buf, int size);
 	inline float process(float inp);
 	void	mute();
 	void	setfeedback(float val);
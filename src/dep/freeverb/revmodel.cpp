@@ -6,36 +6,17 @@
 
 #include "revmodel.hpp"
 #include <math.h>
+#include <xmmintrin.h>
 
-revmodel::revmodel()
+revmodel::revmodel(float samplerate)
 {
-	// Tie the components to their buffers
-	combL[0].setbuffer(bufcombL1,combtuningL1);
-	combR[0].setbuffer(bufcombR1,combtuningR1);
-	combL[1].setbuffer(bufcombL2,combtuningL2);
-	combR[1].setbuffer(bufcombR2,combtuningR2);
-	combL[2].setbuffer(bufcombL3,combtuningL3);
-	combR[2].setbuffer(bufcombR3,combtuningR3);
-	combL[3].setbuffer(bufcombL4,combtuningL4);
-	combR[3].setbuffer(bufcombR4,combtuningR4);
-	combL[4].setbuffer(bufcombL5,combtuningL5);
-	combR[4].setbuffer(bufcombR5,combtuningR5);
-	combL[5].setbuffer(bufcombL6,combtuningL6);
-	combR[5].setbuffer(bufcombR6,combtuningR6);
-	combL[6].setbuffer(bufcombL7,combtuningL7);
-	combR[6].setbuffer(bufcombR7,combtuningR7);
-	combL[7].setbuffer(bufcombL8,combtuningL8);
-	combR[7].setbuffer(bufcombR8,combtuningR8);
-	allpassL[0].setbuffer(bufallpassL1,allpasstuningL1);
-	allpassR[0].setbuffer(bufallpassR1,allpasstuningR1);
-	allpassL[1].setbuffer(bufallpassL2,allpasstuningL2);
-	allpassR[1].setbuffer(bufallpassR2,allpasstuningR2);
-	allpassL[2].setbuffer(bufallpassL3,allpasstuningL3);
-	allpassR[2].setbuffer(bufallpassR3,allpasstuningR3);
-	allpassL[3].setbuffer(bufallpassL4,allpasstuningL4);
-	allpassR[3].setbuffer(bufallpassR4,allpasstuningR4);
+	// Sizes the buffers and ties the components to them
+	memory = 0;
+	setsamplerate(samplerate);
 
 	// Set default values
+	roomsize = damp = wet = width = mode = 0;
+	dirty = true;
 	allpassL[0].setfeedback(0.5f);
 	allpassR[0].setfeedback(0.5f);
 	allpassL[1].setfeedback(0.5f);
@@ -50,9 +31,18 @@ revmodel::revmodel()
 	setdamp(initialdamp);
 	setwidth(initialwidth);
 	setmode(initialmode);
+	update();
+	curgain = gain;
+	curwet1 = wet1;
+	curwet2 = wet2;
+	curdry = dry;
+	curfeedback = roomsize1;
+	curdamp = damp1;
+}
 
-	// Buffer will be full of rubbish - so we MUST mute them
-	mute();
+revmodel::~revmodel()
+{
+	delete[] memory;
 }
 
 void revmodel::mute()
@@ -60,10 +50,10 @@ void revmodel::mute()
 	if (getmode() >= freezemode)
 		return;
 
-	for (int i=0;i<numcombs;i++)
+	for (int i=0;i<numcombs*2;i++)
 	{
-		combL[i].mute();
-		combR[i].mute();
+		for (int j=0;j<combsize[i];j++)
+			combbuffer[i][j] = 0;
 	}
 	for (int i=0;i<numallpasses;i++)
 	{
@@ -72,106 +62,243 @@ void revmodel::mute()
 	}
 }
 
-void revmodel::processreplace(float *inputL, float *inputR, float *outputL, float *outputR, long numsamples, int skip)
+// Four consecutive samples of a comb buffer from idx, wrapping if needed
+static inline __m128 combload(const float *buffer, int size, int idx)
 {
-	float outL,outR,input;
+	if (idx+4 <= size)
+		return _mm_loadu_ps(buffer+idx);
+	float v[4];
+	for (int k=0; k<4; k++)
+		v[k] = buffer[idx+k < size ? idx+k : idx+k-size];
+	return _mm_loadu_ps(v);
+}
 
-	while(numsamples-- > 0)
+static inline void combsave(float *buffer, int size, int idx, __m128 value)
+{
+	if (idx+4 <= size)
 	{
-		outL = outR = 0;
-		input = (*inputL + *inputR) * gain;
-
-		// Accumulate comb filters in parallel
-		for(int i=0; i<numcombs; i++)
-		{
-			outL += combL[i].process(input);
-			outR += combR[i].process(input);
-		}
-
-		// Feed through allpasses in series
-		for(int i=0; i<numallpasses; i++)
-		{
-			outL = allpassL[i].process(outL);
-			outR = allpassR[i].process(outR);
-		}
+		_mm_storeu_ps(buffer+idx, value);
+		return;
+	}
+	float v[4];
+	_mm_storeu_ps(v, value);
+	for (int k=0; k<4; k++)
+		buffer[idx+k < size ? idx+k : idx+k-size] = v[k];
+}
 
-		// Calculate output REPLACING anything already there
-		*outputL = outL*wet1 + outR*wet2 + *inputL*dry;
-		*outputR = outR*wet1 + outL*wet2 + *inputR*dry;
+// Big to inline - but crucial for speed
 
-		// Increment sample pointers, allowing for interleave (if any)
-		inputL += skip;
-		inputR += skip;
-		outputL += skip;
-		outputR += skip;
+// One sample through every comb, the 16 lanes one after the other
+inline void revmodel::processcombs(float input, float &outL, float &outR)
+{
+	outL = outR = 0;
+	for (int i=0; i<numcombs*2; i++)
+	{
+		float output = combbuffer[i][combidx[i]];
+		combstore[i] = (output*combdamp2) + (combstore[i]*combdamp1);
+		combbuffer[i][combidx[i]] = input + (combstore[i]*combfeedback);
+		if(++combidx[i]>=combsize[i]) combidx[i] = 0;
+		if (i < numcombs)
+			outL += output;
+		else
+			outR += output;
 	}
 }
 
-void revmodel::processmix(float *inputL, float *inputR, float *outputL, float *outputR, long numsamples, int skip)
+// Four samples through every comb. The delays are all longer than four
+// samples, so the outputs are read up front as four samples per comb,
+// summed that way, then transposed to four combs per vector for the
+// filterstore recursion and transposed back to be written. The operations
+// and their order per sample are the ones of processcombs, the result is
+// the same to the bit.
+inline void revmodel::processcombs4(const float *input, float *outL, float *outR)
 {
-	float outL,outR,input;
+	__m128 output[numcombs*2];
+	for (int i=0; i<numcombs*2; i++)
+		output[i] = combload(combbuffer[i], combsize[i], combidx[i]);
 
-	while(numsamples-- > 0)
+	// Accumulate comb filters in parallel
+	__m128 sumL = _mm_setzero_ps();
+	__m128 sumR = _mm_setzero_ps();
+	for (int i=0; i<numcombs; i++)
 	{
-		outL = outR = 0;
-		input = (*inputL + *inputR) * gain;
+		sumL = _mm_add_ps(sumL, output[i]);
+		sumR = _mm_add_ps(sumR, output[numcombs+i]);
+	}
+	_mm_storeu_ps(outL, sumL);
+	_mm_storeu_ps(outR, sumR);
+
+	__m128 in0 = _mm_set1_ps(input[0]);
+	__m128 in1 = _mm_set1_ps(input[1]);
+	__m128 in2 = _mm_set1_ps(input[2]);
+	__m128 in3 = _mm_set1_ps(input[3]);
+	__m128 feedback = _mm_set1_ps(combfeedback);
+	__m128 damp1 = _mm_set1_ps(combdamp1);
+	__m128 damp2 = _mm_set1_ps(combdamp2);
+	for (int i=0; i<numcombs*2; i+=4)
+	{
+		__m128 s0 = output[i];
+		__m128 s1 = output[i+1];
+		__m128 s2 = output[i+2];
+		__m128 s3 = output[i+3];
+		_MM_TRANSPOSE4_PS(s0, s1, s2, s3);
+
+		__m128 filterstore = _mm_loadu_ps(combstore+i);
+		filterstore = _mm_add_ps(_mm_mul_ps(s0, damp2), _mm_mul_ps(filterstore, damp1));
+		s0 = _mm_add_ps(in0, _mm_mul_ps(filterstore, feedback));
+		filterstore = _mm_add_ps(_mm_mul_ps(s1, damp2), _mm_mul_ps(filterstore, damp1));
+		s1 = _mm_add_ps(in1, _mm_mul_ps(filterstore, feedback));
+		filterstore = _mm_add_ps(_mm_mul_ps(s2, damp2), _mm_mul_ps(filterstore, damp1));
+		s2 = _mm_add_ps(in2, _mm_mul_ps(filterstore, feedback));
+		filterstore = _mm_add_ps(_mm_mul_ps(s3, damp2), _mm_mul_ps(filterstore, damp1));
+		s3 = _mm_add_ps(in3, _mm_mul_ps(filterstore, feedback));
+		_mm_storeu_ps(combstore+i, filterstore);
+
+		_MM_TRANSPOSE4_PS(s0, s1, s2, s3);
+		combsave(combbuffer[i], combsize[i], combidx[i], s0);
+		combsave(combbuffer[i+1], combsize[i+1], combidx[i+1], s1);
+		combsave(combbuffer[i+2], combsize[i+2], combidx[i+2], s2);
+		combsave(combbuffer[i+3], combsize[i+3], combidx[i+3], s3);
+	}
 
-		// Accumulate comb filters in parallel
-		for(int i=0; i<numcombs; i++)
+	for (int i=0; i<numcombs*2; i++)
+	{
+		combidx[i] += 4;
+		if (combidx[i] >= combsize[i]) combidx[i] -= combsize[i];
+	}
+}
+
+// The block core behind processreplace, processmix and process. The shimmer
+// feedback (if any) goes into the first allpass, wOutputs (if any) get the
+// wet signals alone. Parameters changed since the last block are applied
+// here once, moving linearly from their old values over the block: gain,
+// wet and dry every sample, comb feedback and damping every four samples.
+// Denormals are flushed for the duration of the block, the filterstores
+// would otherwise decay into them on silence.
+void revmodel::processblock(const float *inputL, const float *inputR, const float *fbInputL, const float *fbInputR, float *outputL, float *outputR, float *wOutputL, float *wOutputR, long numsamples, int skip, bool mix)
+{
+	if (numsamples <= 0)
+		return;
+	if (dirty)
+		update();
+
+	unsigned int csr = _mm_getcsr();
+	_mm_setcsr(csr | 0x8040);
+
+	float inc = 1.0f/numsamples;
+	float gain0 = curgain, gainstep = (gain-curgain)*inc;
+	float wet10 = curwet1, wet1step = (wet1-curwet1)*inc;
+	float wet20 = curwet2, wet2step = (wet2-curwet2)*inc;
+	float dry0 = curdry, drystep = (dry-curdry)*inc;
+	float feedback0 = curfeedback, feedbackstep = (roomsize1-curfeedback)*inc;
+	float damp0 = curdamp, dampstep = (damp1-curdamp)*inc;
+
+	long n = 0;
+	while (n < numsamples)
+	{
+		float input[4],outL[4],outR[4];
+		int count = numsamples-n >= 4 ? 4 : 1;
+		for (int k=0; k<count; k++)
 		{
-			outL += combL[i].process(input);
-			outR += combR[i].process(input);
+			input[k] = (*inputL + *inputR) * (gain0 + gainstep*(n+k));
+			inputL += skip;
+			inputR += skip;
 		}
-
-		// Feed through allpasses in series
-		for(int i=0; i<numallpasses; i++)
+		inputL -= count*skip;
+		inputR -= count*skip;
+
+		combfeedback = feedback0 + feedbackstep*n;
+		combdamp1 = damp0 + dampstep*n;
+		combdamp2 = 1-combdamp1;
+		if (count == 4)
+			processcombs4(input, outL, outR);
+		else
+			processcombs(input[0], outL[0], outR[0]);
+
+		for (int k=0; k<count; k++, n++)
 		{
-			outL = allpassL[i].process(outL);
-			outR = allpassR[i].process(outR);
+			// Feed through allpasses in series
+			float l = outL[k], r = outR[k];
+			if (fbInputL)
+			{
+				l = allpassL[0].process(fbInputL[n] + l);
+				r = allpassR[0].process(fbInputR[n] + r);
+			}
+			else
+			{
+				l = allpassL[0].process(l);
+				r = allpassR[0].process(r);
+			}
+			for(int i=1; i<numallpasses; i++)
+			{
+				l = allpassL[i].process(l);
+				r = allpassR[i].process(r);
+			}
+
+			float w1 = wet10 + wet1step*n;
+			float w2 = wet20 + wet2step*n;
+			float d = dry0 + drystep*n;
+			if (wOutputL)
+			{
+				wOutputL[n] = l*w1 + r*w2;
+				wOutputR[n] = r*w1 + l*w2;
+			}
+			if (mix)
+			{
+				// Calculate output MIXING with anything already there
+				*outputL += l*w1 + r*w2 + *inputL*d;
+				*outputR += r*w1 + l*w2 + *inputR*d;
+			}
+			else
+			{
+				// Calculate output REPLACING anything already there
+				*outputL = l*w1 + r*w2 + *inputL*d;
+				*outputR = r*w1 + l*w2 + *inputR*d;
+			}
+
+			// Increment sample pointers, allowing for interleave (if any)
+			inputL += skip;
+			inputR += skip;
+			outputL += skip;
+			outputR += skip;
 		}
+	}
 
-		// Calculate output MIXING with anything already there
-		*outputL += outL*wet1 + outR*wet2 + *inputL*dry;
-		*outputR += outR*wet1 + outL*wet2 + *inputR*dry;
+	curgain = gain;
+	curwet1 = wet1;
+	curwet2 = wet2;
+	curdry = dry;
+	curfeedback = roomsize1;
+	curdamp = damp1;
 
-		// Increment sample pointers, allowing for interleave (if any)
-		inputL += skip;
-		inputR += skip;
-		outputL += skip;
-		outputR += skip;
-	}
+	_mm_setcsr(csr);
 }
 
-void revmodel::process(const float inL, const float inR, const float fbInL, const float fbInR, float &outputL, float &outputR, float &wOutputL, float &wOutputR)
+void revmodel::processreplace(float *inputL, float *inputR, float *outputL, float *outputR, long numsamples, int skip)
 {
-	float outL = 0.0f, outR = 0.0f;
-	float input = (inL + inR) * gain;
-	// Accumulate comb filters in parallel
-	for(int i=0; i<numcombs; i++)
-	{
-		outL += combL[i].process(input);
-		outR += combR[i].process(input);
-	}
+	processblock(inputL, inputR, 0, 0, outputL, outputR, 0, 0, numsamples, skip, false);
+}
 
-	// Feed through allpasses in series
-	for(int i=0; i<numallpasses; i++)
-	{
-		outL = allpassL[i].process((i==0 ? fbInL : 0.0f) + outL);
-		outR = allpassR[i].process((i==0 ? fbInR : 0.0f) + outR);
-	}
+void revmodel::processmix(float *inputL, float *inputR, float *outputL, float *outputR, long numsamples, int skip)
+{
+	processblock(inputL, inputR, 0, 0, outputL, outputR, 0, 0, numsamples, skip, true);
+}
 
-	outputL = outL*wet1 + outR*wet2 + inL*dry;
-	outputR = outR*wet1 + outL*wet2 + inR*dry;
-	wOutputL = outL*wet1 + outR*wet2;
-	wOutputR = outR*wet1 + outL*wet2;
+void revmodel::process(const float inL, const float inR, const float fbInL, const float fbInR, float &outputL, float &outputR, float &wOutputL, float &wOutputR)
+{
+	processblock(&inL, &inR, &fbInL, &fbInR, &outputL, &outputR, &wOutputL, &wOutputR, 1, 1, false);
+}
+
+// Block version of the above
+void revmodel::process(const float *inputL, const float *inputR, const float *fbInputL, const float *fbInputR, float *outputL, float *outputR, float *wOutputL, float *wOutputR, long numsamples)
+{
+	processblock(inputL, inputR, fbInputL, fbInputR, outputL, outputR, wOutputL, wOutputR, numsamples, 1, false);
 }
 
 void revmodel::update()
 {
 // Recalculate internal values after parameter change
 
-	int i;
-
 	wet1 = wet*(width/2 + 0.5f);
 	wet2 = wet*((1-width)/2);
 
@@ -188,28 +315,21 @@ void revmodel::update()
 		gain = fixedgain;
 	}
 
-	for(i=0; i<numcombs; i++)
-	{
-		combL[i].setfeedback(roomsize1);
-		combR[i].setfeedback(roomsize1);
-	}
-
-	for(i=0; i<numcombs; i++)
-	{
-		combL[i].setdamp(damp1);
-		combR[i].setdamp(damp1);
-	}
+	dirty = false;
 }
 
 // The following get/set functions are not inlined, because
 // speed is never an issue when calling them, and also
 // because as you develop the reverb model, you may
 // wish to take dynamic action when they are called.
+// They only record the value, update() runs once at the
+// start of the next block if any of them changed it.
 
 void revmodel::setroomsize(float value)
 {
-	roomsize = (value*scaleroom) + offsetroom;
-	update();
+	value = (value*scaleroom) + offsetroom;
+	dirty |= (value != roomsize);
+	roomsize = value;
 }
 
 float revmodel::getroomsize()
@@ -219,8 +339,9 @@ float revmodel::getroomsize()
 
 void revmodel::setdamp(float value)
 {
-	damp = value * scaledamp;
-	update();
+	value = value * scaledamp;
+	dirty |= (value != damp);
+	damp = value;
 }
 
 float revmodel::getdamp()
@@ -230,8 +351,9 @@ float revmodel::getdamp()
 
 void revmodel::setwet(float value)
 {
-	wet = value*scalewet;
-	update();
+	value = value*scalewet;
+	dirty |= (value != wet);
+	wet = value;
 }
 
 float revmodel::getwet()
@@ -251,8 +373,8 @@ float revmodel::getdry()
 
 void revmodel::setwidth(float value)
 {
+	dirty |= (value != width);
 	width = value;
-	update();
 }
 
 float revmodel::getwidth()
@@ -262,8 +384,8 @@ float revmodel::getwidth()
 
 void revmodel::setmode(float value)
 {
+	dirty |= (value != mode);
 	mode = value;
-	update();
 }
 
 float revmodel::getmode()
@@ -274,72 +396,61 @@ float revmodel::getmode()
 		return 0;
 }
 
+// The tunings are for 44.1kHz, other rates scale the delay lengths so the
+// reverb keeps its size and colour. The buffers are allocated here, so this
+// is for the UI or engine thread while the model is not processing.
+// Parameters are kept, the delay lines start over empty even when frozen.
 void revmodel::setsamplerate(const float samplerate) {
 
 	sampleRate = samplerate;
 	float coeff = sampleRate/44100.0;
 
-	int mctL1 = round(coeff * combtuningL1);
-	int mctR1 = round(coeff * combtuningR1);
-	int mctL2 = round(coeff * combtuningL2);
-	int mctR2 = round(coeff * combtuningR2);
-	int mctL3 = round(coeff * combtuningL3);
-	int mctR3 = round(coeff * combtuningR3);
-	int mctL4 = round(coeff * combtuningL4);
-	int mctR4 = round(coeff * combtuningR4);
-	int mctL5 = round(coeff * combtuningL5);
-	int mctR5 = round(coeff * combtuningR5);
-	int mctL6 = round(coeff * combtuningL6);
-	int mctR6 = round(coeff * combtuningR6);
-	int mctL7 = round(coeff * combtuningL7);
-	int mctR7 = round(coeff * combtuningR7);
-	int mctL8 = round(coeff * combtuningL8);
-	int mctR8 = round(coeff * combtuningR8);
-
-	int maptL1 = round(coeff * allpasstuningL1);
-	int maptR1 = round(coeff * allpasstuningR1);
-	int maptL2 = round(coeff * allpasstuningL2);
-	int maptR2 = round(coeff * allpasstuningR2);
-	int maptL3 = round(coeff * allpasstuningL3);
-	int maptR3 = round(coeff * allpasstuningR3);
-	int maptL4 = round(coeff * allpasstuningL4);
-	int maptR4 = round(coeff * allpasstuningR4);
-
-	mute();
-
-	combL[0].changebuffer(bufcombL1,mctL1);
-	combR[0].changebuffer(bufcombR1,mctR1);
-	combL[1].changebuffer(bufcombL2,mctL2);
-	combR[1].changebuffer(bufcombR2,mctR2);
-	combL[2].changebuffer(bufcombL3,mctL3);
-	combR[2].changebuffer(bufcombR3,mctR3);
-	combL[3].changebuffer(bufcombL4,mctL4);
-	combR[3].changebuffer(bufcombR4,mctR4);
-	combL[4].changebuffer(bufcombL5,mctL5);
-	combR[4].changebuffer(bufcombR5,mctR5);
-	combL[5].changebuffer(bufcombL6,mctL6);
-	combR[5].changebuffer(bufcombR6,mctR6);
-	combL[6].changebuffer(bufcombL7,mctL7);
-	combR[6].changebuffer(bufcombR7,mctR7);
-	combL[7].changebuffer(bufcombL8,mctL8);
-	combR[7].changebuffer(bufcombR8,mctR8);
-
-	allpassL[0].changebuffer(bufallpassL1,maptL1);
-	allpassR[0].changebuffer(bufallpassR1,maptR1);
-	allpassL[1].changebuffer(bufallpassL2,maptL2);
-	allpassR[1].changebuffer(bufallpassR2,maptR2);
-	allpassL[2].changebuffer(bufallpassL3,maptL3);
-	allpassR[2].changebuffer(bufallpassR3,maptR3);
-	allpassL[3].changebuffer(bufallpassL4,maptL4);
-	allpassR[3].changebuffer(bufallpassR4,maptR4);
+	const int combtuning[numcombs*2] = {
+		combtuningL1, combtuningL2, combtuningL3, combtuningL4,
+		combtuningL5, combtuningL6, combtuningL7, combtuningL8,
+		combtuningR1, combtuningR2, combtuningR3, combtuningR4,
+		combtuningR5, combtuningR6, combtuningR7, combtuningR8};
+	const int allpasstuning[numallpasses*2] = {
+		allpasstuningL1, allpasstuningL2, allpasstuningL3, allpasstuningL4,
+		allpasstuningR1, allpasstuningR2, allpasstuningR3, allpasstuningR4};
+
+	// The comb kernel works four samples at a time
+	int total = 0;
+	for (int i=0;i<numcombs*2;i++)
+	{
+		combsize[i] = round(coeff * combtuning[i]);
+		if (combsize[i] < 4) combsize[i] = 4;
+		total += combsize[i];
+	}
+	int allpasssize[numallpasses*2];
+	for (int i=0;i<numallpasses*2;i++)
+	{
+		allpasssize[i] = round(coeff * allpasstuning[i]);
+		if (allpasssize[i] < 1) allpasssize[i] = 1;
+		total += allpasssize[i];
+	}
 
-	setwet(initialwet);
-	setroomsize(initialroom);
-	setdry(initialdry);
-	setdamp(initialdamp);
-	setwidth(initialwidth);
-	setmode(initialmode);
+	// One zeroed block for all the delay lines
+	delete[] memory;
+	memory = new float[total]();
 
+	float *buf = memory;
+	for (int i=0;i<numcombs*2;i++)
+	{
+		combbuffer[i] = buf;
+		combidx[i] = 0;
+		combstore[i] = 0;
+		buf += combsize[i];
+	}
+	for (int i=0;i<numallpasses;i++)
+	{
+		allpassL[i].setbuffer(buf,allpasssize[i]);
+		allpassL[i].bufidx = 0;
+		buf += allpasssize[i];
+		allpassR[i].setbuffer(buf,allpasssize[numallpasses+i]);
+		allpassR[i].bufidx = 0;
+		buf += allpasssize[numallpasses+i];
+	}
 }
 
 //ends
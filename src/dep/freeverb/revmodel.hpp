@@ -7,18 +7,21 @@
 #ifndef _revmodel_
 #define _revmodel_
 
-#include "comb.hpp"
 #include "allpass.hpp"
 #include "tuning.hh"
 
 class revmodel
 {
 public:
-					revmodel();
+					revmodel(float samplerate = 44100);
+					~revmodel();
+					revmodel(const revmodel&) = delete;
+					revmodel& operator=(const revmodel&) = delete;
 			void	mute();
 			void	processmix(float *inputL, float *inputR, float *outputL, float *outputR, long numsamples, int skip);
 			void	processreplace(float *inputL, float *inputR, float *outputL, float *outputR, long numsamples, int skip);
 			void  process(const float inL, const float inR, const float fbInL, const float fbInR, float &outputL, float &outputR, float &wOutputL, float &wOutputR);
+			void	process(const float *inputL, const float *inputR, const float *fbInputL, const float *fbInputR, float *outputL, float *outputR, float *wOutputL, float *wOutputR, long numsamples);
 			void	setroomsize(float value);
 			float	getroomsize();
 			void	setdamp(float value);
@@ -34,6 +37,9 @@ public:
 			void	setsamplerate(const float samplerate);
 private:
 			void	update();
+			void	processcombs(float input, float &outL, float &outR);
+			void	processcombs4(const float *input, float *outL, float *outR);
+			void	processblock(const float *inputL, const float *inputR, const float *fbInputL, const float *fbInputR, float *outputL, float *outputR, float *wOutputL, float *wOutputR, long numsamples, int skip, bool mix);
 private:
 	float	gain;
 	float	roomsize,roomsize1;
@@ -44,45 +50,30 @@ private:
 	float	mode;
 	float sampleRate;
 
-	// The following are all declared inline
-	// to remove the need for dynamic allocation
-	// with its subsequent error-checking messiness
+	// Set by the setters, the values above are then brought up to date
+	// by update() at the start of the next block
+	bool	dirty;
+	// Values in use, moving towards gain, wet1, wet2, dry, roomsize1
+	// and damp1 over each block
+	float	curgain,curwet1,curwet2,curdry,curfeedback,curdamp;
 
-	// Comb filters
-	comb	combL[numcombs];
-	comb	combR[numcombs];
+	// Delay lines of all the combs and allpasses, sized by setsamplerate
+	float	*memory;
+
+	// Comb filters, the left bank in lanes 0-7 and the right one in lanes
+	// 8-15 so they run four at a time with SSE. Each keeps its own buffer
+	// and position, combfeedback and the damping are shared.
+	float	*combbuffer[numcombs*2];
+	int		combsize[numcombs*2];
+	int		combidx[numcombs*2];
+	float	combstore[numcombs*2];
+	// Current comb coefficients, set every four samples from the ramps
+	float	combfeedback;
+	float	combdamp1,combdamp2;
 
 	// Allpass filters
 	allpass	allpassL[numallpasses];
 	allpass	allpassR[numallpasses];
-
-	// Buffers for the combs
-	float	bufcombL1[combtuningL1];
-	float	bufcombR1[combtuningR1];
-	float	bufcombL2[combtuningL2];
-	float	bufcombR2[combtuningR2];
-	float	bufcombL3[combtuningL3];
-	float	bufcombR3[combtuningR3];
-	float	bufcombL4[combtuningL4];
-	float	bufcombR4[combtuningR4];
-	float	bufcombL5[combtuningL5];
-	float	bufcombR5[combtuningR5];
-	float	bufcombL6[combtuningL6];
-	float	bufcombR6[combtuningR6];
-	float	bufcombL7[combtuningL7];
-	float	bufcombR7[combtuningR7];
-	float	bufcombL8[combtuningL8];
-	float	bufcombR8[combtuningR8];
-
-	// Buffers for the allpasses
-	float	bufallpassL1[allpasstuningL1];
-	float	bufallpassR1[allpasstuningR1];
-	float	bufallpassL2[allpasstuningL2];
-	float	bufallpassR2[allpasstuningR2];
-	float	bufallpassL3[allpasstuningL3];
-	float	bufallpassR3[allpasstuningR3];
-	float	bufallpassL4[allpasstuningL4];
-	float	bufallpassR4[allpasstuningR4];
 };
 
 #endif//_revmodel_